@@ -0,0 +1,181 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <functional>
+#include <map>
+#include <optional>
+#include <type_traits>
+
+namespace flux
+{
+  // Aggregators for use with Domain::aggregate. Each row of the aggregating domain has its own
+  // copy, to which the values of related rows are added, and from which they are removed when
+  // they change or the rows relate elsewhere. An aggregator provides:
+  //
+  //     void add(const T& value)
+  //     void remove(const T& value)
+  //     bool tryGet(TValue& result) const
+  //
+  // where tryGet returns false if the aggregator holds no result, such as the minimum of no
+  // values. The values of a field using such an aggregator must be std::optional, so that a
+  // row to which no rows relate any more is given an empty value rather than keeping the one
+  // last calculated. Aggregators that always give a result declare so:
+  //
+  //     static constexpr bool AlwaysHasResult = true;
+  //
+  // Sum and Mean keep a running sum, so with floating-point values each add and remove rounds,
+  // and after many changes the sum may differ slightly from summing the current values afresh.
+  // The error does not outlive the values: once none remain, the sum is reset to exactly zero.
+
+  /// Whether \p TAggregator declares that it always gives a result.
+  template<typename TAggregator, typename = void>
+  struct AggregatorAlwaysHasResult : std::false_type {};
+
+  template<typename TAggregator>
+  struct AggregatorAlwaysHasResult<TAggregator, std::void_t<decltype(TAggregator::AlwaysHasResult)>>
+    : std::integral_constant<bool, TAggregator::AlwaysHasResult> {};
+
+  template<typename T>
+  struct IsOptional : std::false_type {};
+
+  template<typename T>
+  struct IsOptional<std::optional<T>> : std::true_type {};
+
+  /// Sums values, giving zero where there are none.
+  template<typename T>
+  class Sum
+  {
+  public:
+    static constexpr bool AlwaysHasResult = true;
+
+    Sum()
+      : _sum(),
+        _count(0)
+    {}
+
+    void add(const T& value) { _sum += value; _count++; }
+
+    void remove(const T& value)
+    {
+      assert(_count != 0);
+      // Discard any rounding error accumulated while values came and went
+      _sum = --_count == 0 ? T() : _sum - value;
+    }
+
+    template<typename TValue>
+    bool tryGet(TValue& result) const
+    {
+      result = _sum;
+      return true;
+    }
+
+  private:
+    T _sum;
+    size_t _count;
+  };
+
+  /// Counts values, whatever their type.
+  class Count
+  {
+  public:
+    static constexpr bool AlwaysHasResult = true;
+
+    Count()
+      : _count(0)
+    {}
+
+    template<typename T>
+    void add(const T&) { _count++; }
+
+    template<typename T>
+    void remove(const T&) { assert(_count != 0); _count--; }
+
+    template<typename TValue>
+    bool tryGet(TValue& result) const
+    {
+      result = static_cast<TValue>(_count);
+      return true;
+    }
+
+  private:
+    size_t _count;
+  };
+
+  /// Averages values, giving no result where there are none.
+  template<typename T>
+  class Mean
+  {
+  public:
+    Mean()
+      : _sum(),
+        _count(0)
+    {}
+
+    void add(const T& value) { _sum += value; _count++; }
+    void remove(const T& value)
+    {
+      assert(_count != 0);
+      _sum = --_count == 0 ? T() : _sum - value;
+    }
+
+    template<typename TValue>
+    bool tryGet(TValue& result) const
+    {
+      if (_count == 0)
+        return false;
+      // Divide in the result's type, as converting a signed sum to the count's unsigned type
+      // would wrap a negative sum
+      result = static_cast<TValue>(_sum) / static_cast<TValue>(_count);
+      return true;
+    }
+
+  private:
+    T _sum;
+    size_t _count;
+  };
+
+  /// Orders values by \p TCompare, counting duplicates, so that any value may be removed and
+  /// the first found in logarithmic time.
+  template<typename T, typename TCompare>
+  class OrderedAggregator
+  {
+  public:
+    OrderedAggregator()
+      : _counts()
+    {}
+
+    void add(const T& value)
+    {
+      _counts[value]++;
+    }
+
+    void remove(const T& value)
+    {
+      auto it = _counts.find(value);
+      assert(it != _counts.end());
+      if (--it->second == 0)
+        _counts.erase(it);
+    }
+
+    template<typename TValue>
+    bool tryGet(TValue& result) const
+    {
+      if (_counts.empty())
+        return false;
+      result = _counts.begin()->first;
+      return true;
+    }
+
+  private:
+    std::map<T,size_t,TCompare> _counts;
+  };
+
+  /// Gives the least value, or no result where there are none.
+  template<typename T>
+  class Min : public OrderedAggregator<T, std::less<T>> {};
+
+  /// Gives the greatest value, or no result where there are none.
+  template<typename T>
+  class Max : public OrderedAggregator<T, std::greater<T>> {};
+}
@@ -0,0 +1,163 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+namespace flux
+{
+  /// A bump allocator for objects which are all released together.
+  ///
+  /// Memory is obtained in chunks. Resetting releases every allocation at once but retains the
+  /// chunks, so an arena that is filled and reset in a steady cycle stops allocating once it has
+  /// grown to the largest cycle's needs. Destructors are not run; that is the owner's job.
+  class Arena
+  {
+  public:
+    explicit Arena(size_t chunkSize = 16 * 1024)
+      : _chunkSize(chunkSize),
+        _chunks(),
+        _chunk(0),
+        _offset(0)
+    {}
+
+    /// Allocates \p size bytes aligned to \p alignment, which must be a power of two.
+    void* allocate(size_t size, size_t alignment)
+    {
+      assert(alignment != 0 && (alignment & (alignment - 1)) == 0);
+
+      while (_chunk < _chunks.size())
+      {
+        Chunk& chunk = _chunks[_chunk];
+        uintptr_t base = reinterpret_cast<uintptr_t>(chunk.data.get());
+        size_t offset = ((base + _offset + alignment - 1) & ~(alignment - 1)) - base;
+        if (offset + size <= chunk.size)
+        {
+          _offset = offset + size;
+          return chunk.data.get() + offset;
+        }
+
+        // Try the next retained chunk
+        _chunk++;
+        _offset = 0;
+      }
+
+      // All chunks are full, so add another, large enough for this allocation
+      size_t chunkSize = std::max(_chunkSize, size + alignment);
+      _chunks.push_back(Chunk{std::unique_ptr<char[]>(new char[chunkSize]), chunkSize});
+      return allocate(size, alignment);
+    }
+
+    /// Releases all allocations, retaining the memory for reuse.
+    void reset()
+    {
+      _chunk = 0;
+      _offset = 0;
+    }
+
+  private:
+    Arena(const Arena&) = delete;
+    Arena& operator=(const Arena&) = delete;
+
+    struct Chunk
+    {
+      std::unique_ptr<char[]> data;
+      size_t size;
+    };
+
+    size_t _chunkSize;
+    std::vector<Chunk> _chunks;
+    size_t _chunk;
+    size_t _offset;
+  };
+
+  /// A queue of tasks which are run in the order they were added. Each task is stored by value
+  /// in an arena, in a record that knows its type, so adding a task allocates nothing once the
+  /// arena has grown, however much the task captures.
+  class TaskQueue
+  {
+  public:
+    TaskQueue()
+      : _arena(),
+        _head(nullptr),
+        _tail(nullptr)
+    {}
+
+    ~TaskQueue()
+    {
+      clear();
+    }
+
+    bool empty() const { return _head == nullptr; }
+
+    /// Adds \p task, any callable taking no arguments, to the end of the queue.
+    template<typename TTask>
+    void push(TTask&& task)
+    {
+      typedef Record<typename std::decay<TTask>::type> TRecord;
+      void* memory = _arena.allocate(sizeof(TRecord), alignof(TRecord));
+      RecordBase* record = new (memory) TRecord(std::forward<TTask>(task));
+      if (_tail != nullptr)
+        _tail->next = record;
+      else
+        _head = record;
+      _tail = record;
+    }
+
+    /// Runs all tasks, including any added while running, then empties the queue.
+    void run()
+    {
+      for (RecordBase* record = _head; record != nullptr; record = record->next)
+        record->run();
+      clear();
+    }
+
+  private:
+    TaskQueue(const TaskQueue&) = delete;
+    TaskQueue& operator=(const TaskQueue&) = delete;
+
+    struct RecordBase
+    {
+      RecordBase() : next(nullptr) {}
+      virtual ~RecordBase() = default;
+      virtual void run() = 0;
+
+      RecordBase* next;
+    };
+
+    template<typename TTask>
+    struct Record : RecordBase
+    {
+      template<typename TArg>
+      explicit Record(TArg&& arg) : task(std::forward<TArg>(arg)) {}
+
+      void run() override { task(); }
+
+      TTask task;
+    };
+
+    void clear()
+    {
+      RecordBase* record = _head;
+      while (record != nullptr)
+      {
+        RecordBase* next = record->next;
+        record->~RecordBase();
+        record = next;
+      }
+      _head = nullptr;
+      _tail = nullptr;
+      _arena.reset();
+    }
+
+    Arena _arena;
+    RecordBase* _head;
+    RecordBase* _tail;
+  };
+}
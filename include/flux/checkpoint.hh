@@ -0,0 +1,294 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <optional>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace flux
+{
+  /// Writes values to a stream in a compact binary form, in the byte order of the machine.
+  /// Arrays are aligned to BinaryWriter::Alignment from the start of the stream, so that once
+  /// written to a file and memory mapped, arrays of trivially copyable values may be read in
+  /// place or bulk copied.
+  class BinaryWriter
+  {
+  public:
+    static constexpr size_t Alignment = 64;
+
+    explicit BinaryWriter(std::ostream& out)
+      : _out(out),
+        _offset(0)
+    {}
+
+    /// Writes a trivially copyable value.
+    template<typename T>
+    void write(const T& value)
+    {
+      static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values may be written directly");
+      writeBytes(&value, sizeof(T));
+    }
+
+    void writeString(const std::string& value)
+    {
+      write<uint64_t>(value.size());
+      writeBytes(value.data(), value.size());
+    }
+
+    /// Writes \p count trivially copyable values, aligned. The count is not written.
+    template<typename T>
+    void writeArray(const T* values, size_t count)
+    {
+      static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values may be written directly");
+      align();
+      writeBytes(values, count * sizeof(T));
+    }
+
+    /// Begins a section holding \p name, whose contents are of the type named \p typeName.
+    void beginSection(const std::string& name, const std::string& typeName)
+    {
+      writeString(name);
+      writeString(typeName);
+    }
+
+  private:
+    BinaryWriter(const BinaryWriter&) = delete;
+    BinaryWriter& operator=(const BinaryWriter&) = delete;
+
+    void writeBytes(const void* data, size_t size)
+    {
+      _out.write(static_cast<const char*>(data), static_cast<std::streamsize>(size));
+      if (!_out)
+        throw std::runtime_error("Failed to write binary stream");
+      _offset += size;
+    }
+
+    void align()
+    {
+      static const char padding[Alignment] = {};
+      writeBytes(padding, (Alignment - _offset % Alignment) % Alignment);
+    }
+
+    std::ostream& _out;
+    size_t _offset;
+  };
+
+  /// Reads values written by BinaryWriter from memory, such as a MappedFile. Reading beyond
+  /// the end of the data, or finding a section other than that expected, throws
+  /// std::runtime_error.
+  class BinaryReader
+  {
+  public:
+    BinaryReader(const char* data, size_t size)
+      : _data(data),
+        _size(size),
+        _offset(0)
+    {}
+
+    template<typename T>
+    T read()
+    {
+      static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values may be read directly");
+      T value;
+      std::memcpy(&value, readBytes(sizeof(T)), sizeof(T));
+      return value;
+    }
+
+    std::string readString()
+    {
+      size_t size = read<uint64_t>();
+      return std::string(readBytes(size), size);
+    }
+
+    /// Reads \p count trivially copyable values written by writeArray, returning a pointer to
+    /// them within the checkpoint.
+    template<typename T>
+    const T* readArray(size_t count)
+    {
+      static_assert(std::is_trivially_copyable<T>::value, "Only trivially copyable values may be read directly");
+      readBytes((BinaryWriter::Alignment - _offset % BinaryWriter::Alignment) % BinaryWriter::Alignment);
+      if (count > (_size - _offset) / sizeof(T))
+        throw std::runtime_error("Binary data is truncated");
+      return reinterpret_cast<const T*>(readBytes(count * sizeof(T)));
+    }
+
+    /// Reads the start of a section, which must hold \p name and be of the type named \p typeName.
+    void expectSection(const std::string& name, const std::string& typeName)
+    {
+      std::string foundName = readString();
+      std::string foundTypeName = readString();
+      if (foundName != name)
+        throw std::runtime_error("Found '" + foundName + "' where '" + name + "' was expected");
+      if (foundTypeName != typeName)
+        throw std::runtime_error("Found '" + name + "' of a different type");
+    }
+
+    /// Gets the number of bytes read so far.
+    size_t getOffset() const { return _offset; }
+
+    /// Gets the number of bytes not yet read.
+    size_t getRemaining() const { return _size - _offset; }
+
+    /// Gets whether all of the data has been read.
+    bool isAtEnd() const { return _offset == _size; }
+
+  private:
+    BinaryReader(const BinaryReader&) = delete;
+    BinaryReader& operator=(const BinaryReader&) = delete;
+
+    const char* readBytes(size_t size)
+    {
+      if (size > _size - _offset)
+        throw std::runtime_error("Binary data is truncated");
+      const char* bytes = _data + _offset;
+      _offset += size;
+      return bytes;
+    }
+
+    const char* _data;
+    size_t _size;
+    size_t _offset;
+  };
+
+  /// Writes a checkpoint: a binary image of a graph's keys and values.
+  ///
+  /// A checkpoint is a header followed by a sequence of sections, each named for the domain or
+  /// field it holds, so that a checkpoint read into a graph of a different shape is detected.
+  class CheckpointWriter : public BinaryWriter
+  {
+  public:
+    static constexpr uint64_t Magic = 0x54504b4358554c46; // "FLUXCKPT"
+    static constexpr uint32_t Version = 1;
+
+    /// Begins a checkpoint by writing its header to \p out.
+    explicit CheckpointWriter(std::ostream& out)
+      : BinaryWriter(out)
+    {
+      write(Magic);
+      write(Version);
+    }
+  };
+
+  /// Reads a checkpoint written by CheckpointWriter.
+  class CheckpointReader : public BinaryReader
+  {
+  public:
+    /// Begins reading the checkpoint of \p size bytes at \p data, validating its header.
+    CheckpointReader(const char* data, size_t size)
+      : BinaryReader(data, size)
+    {
+      if (read<uint64_t>() != CheckpointWriter::Magic)
+        throw std::runtime_error("Not a checkpoint");
+      if (read<uint32_t>() != CheckpointWriter::Version)
+        throw std::runtime_error("Unsupported checkpoint version");
+    }
+  };
+
+  /// The base of BinaryCodec's primary template, marking types that have no codec.
+  struct UnsupportedBinaryCodec {};
+
+  /// Writes and reads values of a type within a checkpoint or journal. Trivially copyable
+  /// types and strings are supported. Specialise for other types.
+  template<typename T, typename = void>
+  struct BinaryCodec : UnsupportedBinaryCodec
+  {
+    static void write(BinaryWriter&, const T&)
+    {
+      throw std::runtime_error("Type cannot be written to a binary stream");
+    }
+
+    static T read(BinaryReader&)
+    {
+      throw std::runtime_error("Type cannot be read from a binary stream");
+    }
+  };
+
+  template<typename T>
+  struct BinaryCodec<T, typename std::enable_if<std::is_trivially_copyable<T>::value>::type>
+  {
+    static void write(BinaryWriter& writer, const T& value) { writer.write(value); }
+    static T read(BinaryReader& reader) { return reader.read<T>(); }
+  };
+
+  template<>
+  struct BinaryCodec<std::string>
+  {
+    static void write(BinaryWriter& writer, const std::string& value) { writer.writeString(value); }
+    static std::string read(BinaryReader& reader) { return reader.readString(); }
+  };
+
+  /// Optional values, such as those of aggregates which may have no result, whose contained
+  /// type is not trivially copyable.
+  template<typename T>
+  struct BinaryCodec<std::optional<T>, typename std::enable_if<!std::is_trivially_copyable<std::optional<T>>::value>::type>
+  {
+    static void write(BinaryWriter& writer, const std::optional<T>& value)
+    {
+      writer.write(value.has_value());
+      if (value.has_value())
+        BinaryCodec<T>::write(writer, *value);
+    }
+
+    static std::optional<T> read(BinaryReader& reader)
+    {
+      if (!reader.read<bool>())
+        return std::nullopt;
+      return BinaryCodec<T>::read(reader);
+    }
+  };
+
+  /// Whether values of \p T may be written to and read from a checkpoint or journal, being
+  /// trivially copyable, strings, or of a type for which BinaryCodec is specialised.
+  template<typename T>
+  struct IsBinaryCodable : std::integral_constant<bool, !std::is_base_of<UnsupportedBinaryCodec, BinaryCodec<T>>::value> {};
+
+  template<typename T>
+  struct IsBinaryCodable<std::optional<T>> : IsBinaryCodable<T> {};
+
+  /// A read-only memory mapping of a whole file.
+  class MappedFile
+  {
+  public:
+    explicit MappedFile(const std::string& path)
+      : _data(nullptr),
+        _size(0)
+    {
+      int fd = ::open(path.c_str(), O_RDONLY);
+      if (fd == -1)
+        throw std::runtime_error("Unable to open " + path);
+
+      struct stat status;
+      if (::fstat(fd, &status) == 0)
+        _size = static_cast<size_t>(status.st_size);
+
+      void* data = _size == 0 ? MAP_FAILED : ::mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0);
+      ::close(fd);
+      if (data == MAP_FAILED)
+        throw std::runtime_error("Unable to map " + path);
+      _data = static_cast<const char*>(data);
+    }
+
+    ~MappedFile()
+    {
+      ::munmap(const_cast<char*>(_data), _size);
+    }
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+  private:
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* _data;
+    size_t _size;
+  };
+}
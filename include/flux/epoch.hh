@@ -0,0 +1,225 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+namespace flux
+{
+  /// Holds the latest of a series of immutable versions of a value, which one writer publishes
+  /// and many readers read without locking, after epoch-based reclamation.
+  ///
+  /// Each reader has a slot. Pinning records the current epoch in the slot before loading the
+  /// current version, and releasing clears it. A published version replaces the current one,
+  /// which is retired in the epoch it was replaced. A reader may hold a retired version only if
+  /// it pinned in or before that epoch, so the writer frees retired versions once no slot holds
+  /// so early an epoch. Reclamation happens whenever the writer publishes.
+  template<typename T>
+  class Versioned
+  {
+    struct Slot;
+
+  public:
+    /// A pinned version. The version remains valid, however many are published after it,
+    /// until the pin is released or destroyed.
+    class Pin
+    {
+    public:
+      Pin(Pin&& other)
+        : _slot(other._slot),
+          _version(other._version)
+      {
+        other._slot = nullptr;
+        other._version = nullptr;
+      }
+
+      ~Pin()
+      {
+        release();
+      }
+
+      /// Gets the pinned version, or null if none had been published.
+      const T* get() const { return _version; }
+      const T* operator->() const { assert(_version != nullptr); return _version; }
+      const T& operator*() const { assert(_version != nullptr); return *_version; }
+      explicit operator bool() const { return _version != nullptr; }
+
+      /// Releases the version, allowing the writer to reclaim it.
+      void release()
+      {
+        if (_slot == nullptr)
+          return;
+        _slot->epoch.store(0, std::memory_order_release);
+        _slot = nullptr;
+        _version = nullptr;
+      }
+
+    private:
+      Pin(const Pin&) = delete;
+      Pin& operator=(const Pin&) = delete;
+
+      friend class Versioned;
+
+      Pin(Slot* slot, const T* version)
+        : _slot(slot),
+          _version(version)
+      {}
+
+      Slot* _slot;
+      const T* _version;
+    };
+
+    /// A registered reader, which may hold one pin at a time. Must be destroyed before the
+    /// Versioned it reads.
+    class Reader
+    {
+    public:
+      Reader(Reader&& other)
+        : _versioned(other._versioned),
+          _slot(other._slot)
+      {
+        other._versioned = nullptr;
+        other._slot = nullptr;
+      }
+
+      ~Reader()
+      {
+        if (_versioned != nullptr)
+          _versioned->removeReader(_slot);
+      }
+
+      /// Pins the current version. Never blocks or waits upon the writer.
+      Pin pin()
+      {
+        assert(_slot != nullptr);
+        assert(_slot->epoch.load(std::memory_order_relaxed) == 0);
+
+        // The slot must be visible to the writer before the version is loaded, so that the
+        // writer either sees the pin or has already replaced the version this loads
+        _slot->epoch.store(_versioned->_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        return Pin(_slot, _versioned->_current.load(std::memory_order_seq_cst));
+      }
+
+    private:
+      Reader(const Reader&) = delete;
+      Reader& operator=(const Reader&) = delete;
+
+      friend class Versioned;
+
+      Reader(Versioned* versioned, Slot* slot)
+        : _versioned(versioned),
+          _slot(slot)
+      {}
+
+      Versioned* _versioned;
+      Slot* _slot;
+    };
+
+    Versioned()
+      : _current(nullptr),
+        _epoch(1),
+        _mutex(),
+        _slots(),
+        _retired()
+    {}
+
+    ~Versioned()
+    {
+      assert(std::none_of(_slots.begin(), _slots.end(), [](const std::unique_ptr<Slot>& slot) { return slot->isInUse; }));
+      delete _current.load(std::memory_order_relaxed);
+    }
+
+    /// Registers a reader. May be called from any thread.
+    Reader addReader()
+    {
+      std::lock_guard<std::mutex> lock(_mutex);
+      for (auto const& slot : _slots)
+      {
+        if (!slot->isInUse)
+        {
+          slot->isInUse = true;
+          return Reader(this, slot.get());
+        }
+      }
+      _slots.push_back(std::make_unique<Slot>());
+      _slots.back()->isInUse = true;
+      return Reader(this, _slots.back().get());
+    }
+
+    /// Gets the current version. Must only be called by the writer.
+    const T* getCurrent() const
+    {
+      return _current.load(std::memory_order_relaxed);
+    }
+
+    /// Makes \p version current, retiring the prior version, and frees retired versions which
+    /// no reader still holds. Must only be called by the writer.
+    void publish(std::unique_ptr<const T> version)
+    {
+      const T* prior = _current.exchange(version.release(), std::memory_order_seq_cst);
+      if (prior != nullptr)
+        _retired.emplace_back(_epoch.fetch_add(1, std::memory_order_seq_cst), std::unique_ptr<const T>(prior));
+      reclaim();
+    }
+
+    /// Gets the number of retired versions not yet freed, as readers may still hold them.
+    size_t getRetiredCount() const { return _retired.size(); }
+
+  private:
+    Versioned(const Versioned&) = delete;
+    Versioned& operator=(const Versioned&) = delete;
+
+    struct alignas(64) Slot
+    {
+      Slot() : epoch(0), isInUse(false) {}
+
+      /// The epoch in which the reader pinned, or zero if it holds no pin
+      std::atomic<uint64_t> epoch;
+      /// Whether a reader owns this slot, guarded by _mutex
+      bool isInUse;
+    };
+
+    void removeReader(Slot* slot)
+    {
+      assert(slot->epoch.load(std::memory_order_relaxed) == 0);
+      std::lock_guard<std::mutex> lock(_mutex);
+      slot->isInUse = false;
+    }
+
+    void reclaim()
+    {
+      if (_retired.empty())
+        return;
+
+      uint64_t oldestPin = std::numeric_limits<uint64_t>::max();
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        for (auto const& slot : _slots)
+        {
+          uint64_t epoch = slot->epoch.load(std::memory_order_seq_cst);
+          if (epoch != 0)
+            oldestPin = std::min(oldestPin, epoch);
+        }
+      }
+
+      // Versions are retired in order of epoch
+      auto it = std::find_if(_retired.begin(), _retired.end(),
+        [oldestPin](const std::pair<uint64_t,std::unique_ptr<const T>>& retired) { return retired.first >= oldestPin; });
+      _retired.erase(_retired.begin(), it);
+    }
+
+    std::atomic<const T*> _current;
+    std::atomic<uint64_t> _epoch;
+    /// Guards the registration of readers
+    std::mutex _mutex;
+    std::vector<std::unique_ptr<Slot>> _slots;
+    /// Replaced versions, with the epoch in which each was replaced, awaiting reclamation
+    std::vector<std::pair<uint64_t,std::unique_ptr<const T>>> _retired;
+  };
+}
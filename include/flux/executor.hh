@@ -0,0 +1,195 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace flux
+{
+  /// A fixed pool of threads which runs batches of indexed tasks.
+  ///
+  /// Each thread owns a queue of tasks. A batch is split into contiguous blocks, one per queue.
+  /// Threads take tasks from the back of their own queue, and when it is empty, steal from the
+  /// front of other threads' queues, so uneven work is balanced without central coordination.
+  /// The thread that submits a batch takes part in running it.
+  class WorkStealingExecutor
+  {
+  public:
+    /// Creates an executor that runs batches across \p threadCount threads, including the
+    /// thread that calls parallelFor.
+    explicit WorkStealingExecutor(size_t threadCount)
+      : _queues(),
+        _threads(),
+        _mutex(),
+        _wake(),
+        _done(),
+        _body(nullptr),
+        _generation(0),
+        _remaining(0),
+        _stopping(false),
+        _exception()
+    {
+      assert(threadCount != 0);
+
+      for (size_t i = 0; i < threadCount; i++)
+        _queues.push_back(std::make_unique<Queue>());
+
+      // Thread zero is whichever thread calls parallelFor
+      for (size_t i = 1; i < threadCount; i++)
+        _threads.emplace_back([this,i] { workerLoop(i); });
+    }
+
+    ~WorkStealingExecutor()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+      }
+      _wake.notify_all();
+      for (auto& thread : _threads)
+        thread.join();
+    }
+
+    size_t getThreadCount() const { return _queues.size(); }
+
+    /// Invokes \p body once for each index in [0, count), concurrently, returning once all
+    /// invocations have completed. If any invocation throws, the first exception is rethrown
+    /// after the batch completes.
+    void parallelFor(size_t count, const std::function<void(size_t)>& body)
+    {
+      if (count == 0)
+        return;
+
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+
+        assert(_remaining == 0);
+
+        // Set up the batch before queueing any task, as threads still finishing the previous
+        // batch may take them immediately
+        _body = &body;
+        _remaining = count;
+        _exception = nullptr;
+
+        // Deal out contiguous blocks, so that each thread starts on neighbouring tasks
+        size_t queueCount = _queues.size();
+        for (size_t q = 0; q < queueCount; q++)
+        {
+          std::lock_guard<std::mutex> queueLock(_queues[q]->mutex);
+          for (size_t i = count * q / queueCount; i < count * (q + 1) / queueCount; i++)
+            _queues[q]->tasks.push_back(i);
+        }
+
+        _generation++;
+      }
+
+      _wake.notify_all();
+
+      runTasks(0);
+
+      std::unique_lock<std::mutex> lock(_mutex);
+      _done.wait(lock, [this] { return _remaining == 0; });
+
+      if (_exception)
+        std::rethrow_exception(_exception);
+    }
+
+  private:
+    WorkStealingExecutor(const WorkStealingExecutor&) = delete;
+    WorkStealingExecutor& operator=(const WorkStealingExecutor&) = delete;
+
+    struct Queue
+    {
+      std::mutex mutex;
+      std::deque<size_t> tasks;
+    };
+
+    void workerLoop(size_t worker)
+    {
+      size_t generation = 0;
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _wake.wait(lock, [&] { return _stopping || _generation != generation; });
+          if (_stopping)
+            return;
+          generation = _generation;
+        }
+        runTasks(worker);
+      }
+    }
+
+    void runTasks(size_t worker)
+    {
+      size_t task;
+      while (tryTake(worker, task))
+      {
+        try
+        {
+          (*_body)(task);
+        }
+        catch (...)
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          if (!_exception)
+            _exception = std::current_exception();
+        }
+
+        if (--_remaining == 0)
+        {
+          std::lock_guard<std::mutex> lock(_mutex);
+          _done.notify_all();
+        }
+      }
+    }
+
+    bool tryTake(size_t worker, size_t& task)
+    {
+      // Newest first from our own queue
+      {
+        Queue& own = *_queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (!own.tasks.empty())
+        {
+          task = own.tasks.back();
+          own.tasks.pop_back();
+          return true;
+        }
+      }
+
+      // Oldest first from the others
+      for (size_t i = 1; i < _queues.size(); i++)
+      {
+        Queue& victim = *_queues[(worker + i) % _queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty())
+        {
+          task = victim.tasks.front();
+          victim.tasks.pop_front();
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    std::vector<std::unique_ptr<Queue>> _queues;
+    std::vector<std::thread> _threads;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _done;
+    const std::function<void(size_t)>* _body;
+    size_t _generation;
+    std::atomic<size_t> _remaining;
+    bool _stopping;
+    std::exception_ptr _exception;
+  };
+}
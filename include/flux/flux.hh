@@ -1,11 +1,30 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bitset>
 #include <cassert>
+#include <chrono>
+#include <cstdint>
+#include <iterator>
+#include <limits>
 #include <map>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <deque>
+#include <fstream>
+#include <functional>
 #include <set>
 #include <sstream>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
 
 #include <camshaft/any.hh>
 #include <camshaft/demangle.hh>
@@ -13,6 +32,16 @@
 #include <camshaft/memory.hh>
 #include <camshaft/uuid.hh>
 
+#include "aggregate.hh"
+#include "arena.hh"
+#include "checkpoint.hh"
+#include "epoch.hh"
+#include "executor.hh"
+#include "histogram.hh"
+#include "journal.hh"
+#include "queue.hh"
+#include "window.hh"
+
 //static std::ostream& operator<<(std::ostream& s, any a)
 //{
 //  if (a.is<std::string>())
@@ -35,418 +64,3108 @@ namespace flux
   class ComputedFieldBase;
   class DomainBase;
 
-  class FieldBase
+  /// Identifies a key within a domain. Rows are assigned densely, in order of first
+  /// appearance, and remain stable for the lifetime of the domain.
+  struct RowId
   {
-  public:
-    explicit FieldBase(std::string name)
-      : _name(name)
-    {}
-
-    virtual ~FieldBase() = default;
-
-    virtual DomainBase& getDomain() const = 0;
-    virtual any getValue(const any& key) const = 0;
-    virtual void addDependant(ComputedFieldBase* dependant) = 0;
+    static constexpr uint32_t InvalidIndex = std::numeric_limits<uint32_t>::max();
 
-    std::string getName() const { return _name; }
+    constexpr RowId() : index(InvalidIndex) {}
+    constexpr explicit RowId(uint32_t i) : index(i) {}
 
-    virtual void visit(std::function<void(const std::pair<any,any>&)>) = 0;
+    bool isValid() const { return index != InvalidIndex; }
 
-    virtual std::function<void()> subscribe(std::function<void(const any&,const any&)> callback) = 0;
+    bool operator==(const RowId& other) const { return index == other.index; }
+    bool operator!=(const RowId& other) const { return index != other.index; }
+    bool operator<(const RowId& other) const { return index < other.index; }
 
-  private:
-    std::string _name;
+    uint32_t index;
   };
 
-  class Params
+  /// A non-owning view over a contiguous sequence of elements.
+  template<typename T>
+  class Span
   {
   public:
-    Params(std::map<const DomainBase*,any> keyByDomain,
-           std::map<const FieldBase*,any> valueByField)
-    : _keyByDomain(keyByDomain),
-      _valueByField(valueByField)
-    {}
+    Span() : _data(nullptr), _size(0) {}
+    Span(T* data, size_t size) : _data(data), _size(size) {}
 
-    template<typename TField>
-    typename TField::ValueType operator()(const TField& field) const
-    {
-      auto it = _valueByField.find(&field);
-      assert(it != _valueByField.end());
-      assert(!it->second.empty());
-      return any_cast<typename TField::ValueType>(it->second);
-    }
+    /// Views the elements of a contiguous container, such as a std::vector or std::array.
+    template<typename TContainer,
+             typename = typename std::enable_if<std::is_convertible<decltype(std::declval<TContainer&>().data()), T*>::value>::type>
+    Span(TContainer& container) : _data(container.data()), _size(container.size()) {}
 
-    template <typename TField>
-    const typename TField::KeyType& key(const TField& field) const
-    {
-      auto it = _keyByDomain.find(&field.getDomain());
-      assert(it != _keyByDomain.end());
-      return any_cast<typename TField::KeyType>(it->second);
-    }
+    T* begin() const { return _data; }
+    T* end() const { return _data + _size; }
+    T* data() const { return _data; }
+    size_t size() const { return _size; }
+    bool empty() const { return _size == 0; }
+    T& operator[](size_t i) const { assert(i < _size); return _data[i]; }
 
   private:
-    Params(const Params&) = delete;
-    Params& operator=(const Params&) = delete;
-
-    std::map<const DomainBase*,any> _keyByDomain;
-    std::map<const FieldBase*,any> _valueByField;
+    T* _data;
+    size_t _size;
   };
 
-  template<typename TValue, typename TKey>
-  class TypedFieldBase : public virtual FieldBase
+  /// A set of rows which iterates in insertion order and tests membership via a bitmap.
+  /// Clearing retains capacity, so a set that is repeatedly filled and cleared stops allocating.
+  class RowSet
   {
   public:
-    typedef TValue ValueType;
-    typedef TKey KeyType;
-
-    TypedFieldBase(std::string name, Domain<TKey>& domain)
-      : FieldBase(name),
-        _domain(domain),
-        _valueByKey(),
-        _observers(),
-        _dependantComputations()
-    {}
-
-    ~TypedFieldBase() override = default;
+    RowSet() = default;
 
-    std::function<void()> subscribe(std::function<void(const any&,const any&)> observer) override
+    /// Adds \p row to the set, returning false if it was already present.
+    bool insert(RowId row)
     {
-      return subscribe([observer](const TKey& key,const TValue& value)
-      {
-        any anyKey = key;
-        any anyValue = value;
-        observer(anyKey, anyValue);
-      });
+      assert(row.isValid());
+      size_t word = row.index / 64;
+      if (word >= _mask.size())
+        _mask.resize(std::max(word + 1, _mask.size() * 2), 0);
+      uint64_t bit = uint64_t(1) << (row.index % 64);
+      if (_mask[word] & bit)
+        return false;
+      _mask[word] |= bit;
+      _rows.push_back(row);
+      return true;
     }
 
-    std::function<void()> subscribe(std::function<void(const TKey&,const TValue&)> observer)
+    bool contains(RowId row) const
     {
-      // Give each subscription an ID. This allows removal of the subscription later.
-      // This is because std::function is not comparable.
-      static ulong nextObserverId = 0;
-      ulong observerId = nextObserverId++;
-
-      _observers.emplace(
-        std::piecewise_construct,
-        std::forward_as_tuple(observerId),
-        std::forward_as_tuple(observer));
-
-      // Return a function that cancels the subscription when invoked
-      return [this,observer,observerId]
-      {
-        size_t removedCount = _observers.erase(observerId);
-        assert(removedCount == 1);
-      };
+      size_t word = row.index / 64;
+      return word < _mask.size() && (_mask[word] & (uint64_t(1) << (row.index % 64))) != 0;
     }
 
-    DomainBase& getDomain() const override
+    void clear()
     {
-      return _domain;
+      for (RowId row : _rows)
+        _mask[row.index / 64] = 0;
+      _rows.clear();
     }
 
-    void addDependant(ComputedFieldBase* dependant) override
+    void swap(RowSet& other)
     {
-      _dependantComputations.insert(dependant);
+      _mask.swap(other._mask);
+      _rows.swap(other._rows);
     }
 
-    std::set<ComputedFieldBase*>& getDependants() { return _dependantComputations; }
+    bool empty() const { return _rows.empty(); }
+    size_t size() const { return _rows.size(); }
 
-    virtual void setValue(const TKey& key, const TValue& value)
-    {
-      // Store new value
-      _valueByKey[key] = value;
+    /// Gets the \p i'th row, in order of insertion.
+    RowId operator[](size_t i) const { return _rows[i]; }
 
-      // If any computed properties depend upon this, set 'computation required' and store relevant data
-      if (!_dependantComputations.empty())
-        _domain.onComputationInputChanged(*this, key);
+    Span<const RowId> getRows() const { return Span<const RowId>(_rows.data(), _rows.size()); }
 
-      // If any clients have subscribed, set 'publish required' and store relevant data
-      if (_observers.size())
-        _domain.addPublishTask([=] { notifyObservers(key, value); });
-    }
+    std::vector<RowId>::const_iterator begin() const { return _rows.begin(); }
+    std::vector<RowId>::const_iterator end() const { return _rows.end(); }
 
-    TValue getValue(const TKey key) const
-    {
-      auto it = find(key);
-      if (it == end())
-        throw std::runtime_error("No value exists for key");
-      return it->second;
-    }
+  private:
+    RowSet(const RowSet&) = delete;
+    RowSet& operator=(const RowSet&) = delete;
 
-    any getValue(const any& key) const override
-    {
-      const TKey& k = any_cast<TKey>(key);
-      auto it = find(k);
-      return it == end() ? any() : it->second;
-    }
+    std::vector<uint64_t> _mask;
+    std::vector<RowId> _rows;
+  };
 
-    typename std::map<TKey,TValue>::const_iterator find(const TKey& key) const
-    {
-      return _valueByKey.find(key);
-    }
+  /// Hashes keys for a domain's key dictionary. Specialise for key types that lack a std::hash.
+  /// Overloads may accept other types that compare equal to the key, allowing lookup without
+  /// constructing a temporary key.
+  template<typename TKey>
+  struct KeyHash : std::hash<TKey> {};
 
-    typename std::map<TKey,TValue>::const_iterator begin() const { return _valueByKey.begin(); }
+  template<>
+  struct KeyHash<std::string>
+  {
+    size_t operator()(std::string_view key) const { return std::hash<std::string_view>()(key); }
+  };
 
-    typename std::map<TKey,TValue>::const_iterator end() const { return _valueByKey.end(); }
+  /// Maps keys to dense rows. Keys are never removed, so rows are stable.
+  ///
+  /// This general form is used for keys which have no KeyHash, and is ordered.
+  template<typename TKey, typename = void>
+  class KeyDictionary
+  {
+  public:
+    KeyDictionary() = default;
 
-    size_t count() const { return _valueByKey.size(); }
+    template<typename TLookup>
+    RowId find(const TLookup& key) const
+    {
+      auto it = _rowByKey.find(key);
+      return it == _rowByKey.end() ? RowId() : it->second;
+    }
 
-    void notifyObservers(const TKey& key, const TValue& value)
+    template<typename TLookup>
+    RowId insert(const TLookup& key)
     {
-      for (auto& pair : _observers)
-        pair.second(key, value);
+      auto it = _rowByKey.find(key);
+      if (it != _rowByKey.end())
+        return it->second;
+      RowId row(static_cast<uint32_t>(_keys.size()));
+      _keys.emplace_back(key);
+      _rowByKey.emplace(_keys.back(), row);
+      return row;
     }
 
-    void visit(std::function<void(const std::pair<any,any>&)> visitor) override
+    const TKey& operator[](RowId row) const
     {
-      for (auto const& pair : _valueByKey)
-      {
-        std::pair<any,any> anyPair(pair.first, pair.second);
-        visitor(anyPair);
-      }
+      assert(row.index < _keys.size());
+      return _keys[row.index];
     }
 
+    size_t size() const { return _keys.size(); }
+
   private:
-    TypedFieldBase(const TypedFieldBase&) = delete;
-    TypedFieldBase& operator=(const TypedFieldBase&) = delete;
+    KeyDictionary(const KeyDictionary&) = delete;
+    KeyDictionary& operator=(const KeyDictionary&) = delete;
 
-    Domain<TKey>& _domain;
-    std::map<TKey,TValue> _valueByKey;
-    std::map<ulong,std::function<void(const TKey&,const TValue&)>> _observers;
-    std::set<ComputedFieldBase*> _dependantComputations;
+    std::map<TKey,RowId,std::less<>> _rowByKey;
+    std::vector<TKey> _keys;
   };
 
-  class ComputedFieldBase
+  /// Maps keys to dense rows via an open-addressed hash table over the row order key list.
+  template<typename TKey>
+  class KeyDictionary<TKey, typename std::enable_if<std::is_default_constructible<KeyHash<TKey>>::value>::type>
   {
   public:
-    virtual ~ComputedFieldBase() = default;
+    KeyDictionary()
+      : _slots(16),
+        _shift(64 - 4),
+        _keys()
+    {}
 
-    virtual DomainBase& getDomain() const = 0;
+    template<typename TLookup>
+    RowId find(const TLookup& key) const
+    {
+      uint32_t hash = static_cast<uint32_t>(KeyHash<TKey>()(key));
+      for (size_t i = slotOf(hash); _slots[i].row != 0; i = (i + 1) & (_slots.size() - 1))
+      {
+        const Slot& slot = _slots[i];
+        if (slot.hash == hash && _keys[slot.row - 1] == key)
+          return RowId(slot.row - 1);
+      }
+      return RowId();
+    }
 
-    virtual bool recalculate(const any& key) = 0;
+    template<typename TLookup>
+    RowId insert(const TLookup& key)
+    {
+      uint32_t hash = static_cast<uint32_t>(KeyHash<TKey>()(key));
+      size_t i = slotOf(hash);
+      for (; _slots[i].row != 0; i = (i + 1) & (_slots.size() - 1))
+      {
+        const Slot& slot = _slots[i];
+        if (slot.hash == hash && _keys[slot.row - 1] == key)
+          return RowId(slot.row - 1);
+      }
 
-    const std::set<FieldBase*>& getDependencies() const { return _dependencies; }
+      RowId row(static_cast<uint32_t>(_keys.size()));
+      _keys.emplace_back(key);
+      _slots[i] = Slot{row.index + 1, hash};
 
-  protected:
-    explicit ComputedFieldBase(std::set<FieldBase*> dependencies)
-      : _dependencies(dependencies)
-    {}
+      // Keep the load factor at or below one half
+      if (_keys.size() * 2 > _slots.size())
+        rehash();
 
-    std::set<FieldBase*> _dependencies;
-  };
+      return row;
+    }
 
-  template<typename TValue, typename TKey>
-  class Field : public TypedFieldBase<TValue, TKey>
-  {
-  public:
-    Field(std::string name, Domain<TKey>& domain)
-      : FieldBase(name),
-        TypedFieldBase<TValue, TKey>(name, domain)
-    {}
+    const TKey& operator[](RowId row) const
+    {
+      assert(row.index < _keys.size());
+      return _keys[row.index];
+    }
 
-    ~Field() override = default;
+    size_t size() const { return _keys.size(); }
 
   private:
-    Field(const Field&) = delete;
-    Field& operator=(const Field&) = delete;
-  };
+    KeyDictionary(const KeyDictionary&) = delete;
+    KeyDictionary& operator=(const KeyDictionary&) = delete;
 
-  class RelationFieldBase : virtual public FieldBase
-  {
-  public:
-    explicit RelationFieldBase(std::string name)
-      : FieldBase(name)
-    {}
+    struct Slot
+    {
+      uint32_t row; // one more than the row, so that zero marks an empty slot
+      uint32_t hash;
+    };
 
-    virtual std::vector<any> getKeys(any const& remoteKey) const = 0;
+    size_t slotOf(uint32_t hash) const
+    {
+      // Fibonacci hashing spreads out the identity hashes std::hash gives integers
+      return static_cast<size_t>((hash * 0x9E3779B97F4A7C15ull) >> _shift);
+    }
 
-    virtual DomainBase& getRemoteDomain() const = 0;
+    void rehash()
+    {
+      std::vector<Slot> slots(_slots.size() * 2);
+      _slots.swap(slots);
+      _shift--;
+      for (const Slot& slot : slots)
+      {
+        if (slot.row == 0)
+          continue;
+        size_t i = slotOf(slot.hash);
+        while (_slots[i].row != 0)
+          i = (i + 1) & (_slots.size() - 1);
+        _slots[i] = slot;
+      }
+    }
 
-  private:
-    RelationFieldBase(const RelationFieldBase&) = delete;
-    RelationFieldBase& operator=(const RelationFieldBase&) = delete;
+    std::vector<Slot> _slots;
+    unsigned _shift;
+    std::vector<TKey> _keys;
   };
 
-  template<typename TKeyLocal, typename TKeyRemote>
-  class RelationField : public RelationFieldBase, public TypedFieldBase<TKeyRemote, TKeyLocal>
+  /// An immutable copy of a KeyDictionary.
+  ///
+  /// Keys are held in segments of consecutive rows, each with its own dictionary. A snapshot
+  /// taken after another shares its segments, adding one for the keys added since. Where the
+  /// newest segment would be no larger than the one before, they are combined, so that a
+  /// snapshot has O(log n) segments and each key is copied O(log n) times in all.
+  template<typename TKey>
+  class KeySnapshot
   {
   public:
-    RelationField(std::string name, Domain<TKeyLocal>& localDomain, Domain<TKeyRemote>& remoteDomain)
-      : FieldBase(name),
-        RelationFieldBase(name),
-        TypedFieldBase<TKeyRemote, TKeyLocal>(name, localDomain),
-        _remoteDomain(remoteDomain),
-        _localKeysByRemoteKey()
-    {}
-
-    std::vector<any> getKeys(any const& remoteKey) const override
+    /// Copies \p keys, sharing segments with \p previous, the snapshot taken before.
+    static std::shared_ptr<const KeySnapshot> extend(const std::shared_ptr<const KeySnapshot>& previous, const KeyDictionary<TKey>& keys)
     {
-      assert(!remoteKey.empty());
-      assert(remoteKey.is<TKeyRemote>());
+      if (previous && previous->size() == keys.size())
+        return previous;
 
-      std::vector<any> keys;
-      auto it = _localKeysByRemoteKey.equal_range(any_cast<TKeyRemote>(remoteKey));
-      for (auto i = it.first; i != it.second; i++)
-        keys.emplace_back(i->second);
-      return std::move(keys);
+      auto snapshot = std::make_shared<KeySnapshot>();
+      if (previous)
+        snapshot->_segments = previous->_segments;
+
+      size_t begin = previous ? previous->size() : 0;
+      while (!snapshot->_segments.empty() && snapshot->_segments.back()->keys.size() <= keys.size() - begin)
+      {
+        begin = snapshot->_segments.back()->firstRow;
+        snapshot->_segments.pop_back();
+      }
+
+      auto segment = std::make_shared<Segment>();
+      segment->firstRow = static_cast<uint32_t>(begin);
+      for (size_t row = begin; row < keys.size(); row++)
+        segment->keys.insert(keys[RowId(static_cast<uint32_t>(row))]);
+      snapshot->_segments.push_back(std::move(segment));
+      snapshot->_size = keys.size();
+      return snapshot;
     }
 
-    DomainBase& getRemoteDomain() const override
+    /// Returns the row assigned to \p key, or an invalid row if it had not been seen.
+    template<typename TLookup>
+    RowId find(const TLookup& key) const
     {
-      return _remoteDomain;
+      for (auto const& segment : _segments)
+      {
+        RowId row = segment->keys.find(key);
+        if (row.isValid())
+          return RowId(segment->firstRow + row.index);
+      }
+      return RowId();
     }
 
-    void setValue(TKeyLocal const& key, TKeyRemote const& value) override
+    const TKey& operator[](RowId row) const
     {
-      TypedFieldBase<TKeyRemote, TKeyLocal>::setValue(key, value);
-      _localKeysByRemoteKey.insert(std::make_pair(value, key));
+      assert(row.index < _size);
+      auto it = std::upper_bound(_segments.begin(), _segments.end(), row.index,
+        [](uint32_t index, const std::shared_ptr<const Segment>& segment) { return index < segment->firstRow; });
+      const Segment& segment = **std::prev(it);
+      return segment.keys[RowId(row.index - segment.firstRow)];
     }
 
+    size_t size() const { return _size; }
+
   private:
-    Domain<TKeyRemote>& _remoteDomain;
-    std::multimap<TKeyRemote, TKeyLocal> _localKeysByRemoteKey;
+    struct Segment
+    {
+      uint32_t firstRow = 0;
+      KeyDictionary<TKey> keys;
+    };
+
+    std::vector<std::shared_ptr<const Segment>> _segments;
+    size_t _size = 0;
   };
 
-  class DomainBase
+  template<typename> class Column;
+
+  /// An immutable copy of a Column's values, held in fixed size chunks. A snapshot taken after
+  /// another shares the chunks in which no value has changed since.
+  template<typename TValue>
+  class ColumnSnapshot
   {
   public:
-    explicit DomainBase(std::string name)
-      : _name(name)
-    {}
+    static const size_t ChunkSize = 256;
 
-    virtual ~DomainBase() = default;
+    bool has(RowId row) const
+    {
+      const Chunk* chunk = chunkOf(row);
+      return chunk != nullptr && (chunk->present[(row.index % ChunkSize) / 64] & (uint64_t(1) << (row.index % 64))) != 0;
+    }
 
-    virtual bool isComputeRequired() const = 0;
-    virtual bool isPublishRequired() const = 0;
-    virtual void compute() = 0;
-    virtual void publish() = 0;
+    const TValue& get(RowId row) const
+    {
+      assert(has(row));
+      return chunkOf(row)->values[row.index % ChunkSize];
+    }
 
-    /// Gets a vector containing a sequence of foreign keys that may be followed in order
-    /// to traverse from this domain to a related domain. If the vector is empty, then no
-    /// such path exists.
-    virtual const std::vector<RelationFieldBase*>& getRelationPathTo(const DomainBase& relatedDomain) = 0;
-    virtual any getRelatedKey(any key, const DomainBase& relatedDomain) = 0;
-    virtual void addComputeTask(std::function<void()>&& callback) = 0;
-    virtual const std::vector<std::unique_ptr<FieldBase>>& getFields() const = 0;
-    virtual const std::vector<RelationFieldBase*> getForeignKeys() const = 0;
+    size_t count() const { return _count; }
 
-    std::string getName() const { return _name; }
+  private:
+    friend class Column<TValue>;
 
-    FieldBase* findField(std::string fieldName) const
+    struct Chunk
     {
-      // TODO this could be O(1) instead of O(N) if we want to manage another map
-      for (auto const& field : getFields())
-        if (field->getName() == fieldName)
-          return field.get();
-      return nullptr;
+      Chunk() : values(), present() {}
+
+      TValue values[ChunkSize];
+      uint64_t present[ChunkSize / 64];
+    };
+
+    const Chunk* chunkOf(RowId row) const
+    {
+      size_t chunk = row.index / ChunkSize;
+      return row.isValid() && chunk < _chunks.size() ? _chunks[chunk].get() : nullptr;
     }
 
-  private:
-    std::string _name;
+    /// Null where no row of the chunk holds a value
+    std::vector<std::shared_ptr<const Chunk>> _chunks;
+    size_t _count = 0;
   };
 
-  template<typename TValue, typename TKey>
-  class ComputedField
-    : public ComputedFieldBase,
-      public TypedFieldBase<TValue, TKey>
+  /// Contiguous storage of a single field's values, indexed by row, with a bitmap
+  /// recording which rows hold a value.
+  template<typename TValue>
+  class Column
   {
   public:
-    ComputedField(
-      std::string name,
-      Domain<TKey>& domain,
-      std::set<FieldBase*> dependencies,
-      std::function<TValue(const Params&)> calculation)
-      : FieldBase(name),
-        ComputedFieldBase(dependencies),
-        TypedFieldBase<TValue, TKey>(name, domain),
-        _calculation(calculation)
-      {}
+    Column()
+      : _values(),
+        _capacity(0),
+        _present(),
+        _count(0),
+        _isSnapshotted(false),
+        _dirtyChunks()
+    {}
 
-    ~ComputedField() override = default;
+    bool has(RowId row) const
+    {
+      return row.index < _capacity && (_present[row.index / 64] & bit(row.index)) != 0;
+    }
 
-    bool recalculate(const any& key) override
+    const TValue& get(RowId row) const
     {
-      assert(!key.empty());
-      assert(key.is<TKey>());
+      assert(has(row));
+      return _values[row.index];
+    }
 
-//      std::cout << "  recalculate " << getDomain().getName() << "::" << this->getName() << " (computed)" << std::endl;
+    void set(RowId row, const TValue& value)
+    {
+      assert(row.isValid());
+      if (row.index >= _capacity)
+        grow(row.index + 1);
+      _values[row.index] = value;
+      uint64_t& word = _present[row.index / 64];
+      if ((word & bit(row.index)) == 0)
+      {
+        word |= bit(row.index);
+        _count++;
+      }
+      if (_isSnapshotted)
+      {
+        size_t chunk = row.index / ColumnSnapshot<TValue>::ChunkSize;
+        _dirtyChunks[chunk / 64] |= bit(static_cast<uint32_t>(chunk));
+      }
+    }
 
-      std::map<DomainBase const*, any> keyByDomain {{&getDomain(), key}};
-      std::map<FieldBase const*, any> valueByField;
+    /// Copies this column's values. Once snapshotted, the column tracks which chunks of values
+    /// change, so that each later snapshot copies only those, sharing the rest with \p previous,
+    /// the snapshot taken before it.
+    std::shared_ptr<const ColumnSnapshot<TValue>> snapshot(const std::shared_ptr<const ColumnSnapshot<TValue>>& previous)
+    {
+      typedef ColumnSnapshot<TValue> TSnapshot;
+      typedef typename TSnapshot::Chunk TChunk;
 
-      for (FieldBase* dependency : _dependencies)
+      size_t chunkCount = (_capacity + TSnapshot::ChunkSize - 1) / TSnapshot::ChunkSize;
+      if (!_isSnapshotted || !previous)
+      {
+        // Every chunk must be copied
+        _isSnapshotted = true;
+        _dirtyChunks.assign((chunkCount + 63) / 64, ~uint64_t(0));
+      }
+      else if (std::all_of(_dirtyChunks.begin(), _dirtyChunks.end(), [](uint64_t word) { return word == 0; }))
       {
-//        std::cout << "    dependency: " << dependency->getDomain().getName() << "::" << dependency->getName() << std::endl;
+        return previous;
+      }
 
-        //
-        // Find dependency's key
-        //
+      auto snapshot = std::make_shared<TSnapshot>();
+      if (previous)
+        snapshot->_chunks = previous->_chunks;
+      snapshot->_chunks.resize(chunkCount);
+      snapshot->_count = _count;
 
-        any dependencyKey;
-        auto keyIt = keyByDomain.find(&dependency->getDomain());
-        if (keyIt == keyByDomain.end())
+      for (size_t chunk = 0; chunk < chunkCount; chunk++)
+      {
+        if ((_dirtyChunks[chunk / 64] & bit(static_cast<uint32_t>(chunk))) == 0)
+          continue;
+        size_t begin = chunk * TSnapshot::ChunkSize;
+        size_t end = std::min(begin + TSnapshot::ChunkSize, _capacity);
+        if (std::all_of(&_present[begin / 64], &_present[0] + end / 64, [](uint64_t word) { return word == 0; }))
         {
-          // dependant's key not found -- attempt to find it via a relation
-          dependencyKey = getDomain().getRelatedKey(key, dependency->getDomain());
-          if (dependencyKey.empty())
-          {
-//            std::cout << "      dependencyKey not found for " << dependency->getName() << std::endl;
-            return false;
-          }
-//          else
-//          {
-//            std::cout << "      dependencyKey found for " << dependency->getName() << " (related domain): " << dependencyKey << std::endl;
-//          }
+          // The first snapshot marks every chunk dirty, including those where no row holds a value
+          snapshot->_chunks[chunk] = nullptr;
+          continue;
+        }
+        auto copy = std::make_shared<TChunk>();
+        std::copy(&_values[begin], &_values[0] + end, copy->values);
+        std::copy(&_present[begin / 64], &_present[0] + end / 64, copy->present);
+        snapshot->_chunks[chunk] = std::move(copy);
+      }
+
+      std::fill(_dirtyChunks.begin(), _dirtyChunks.end(), 0);
+      return snapshot;
+    }
+
+    /// Writes this column's values. Values of trivially copyable types are written as a single
+    /// array, and others one by one via BinaryCodec.
+    void writeCheckpoint(CheckpointWriter& writer) const
+    {
+      writer.write<uint64_t>(_count);
+      writer.write<uint64_t>(_capacity);
+      writer.writeArray(_present.data(), _present.size());
+      writeValues(writer, std::is_trivially_copyable<TValue>());
+    }
+
+    /// Replaces this column's values with those written by writeCheckpoint.
+    void readCheckpoint(CheckpointReader& reader)
+    {
+      size_t count = reader.read<uint64_t>();
+      size_t capacity = reader.read<uint64_t>();
+      if (capacity % 64 != 0)
+        throw std::runtime_error("Checkpoint holds a malformed column");
+
+      std::unique_ptr<TValue[]> values(new TValue[capacity]);
+      const uint64_t* present = reader.readArray<uint64_t>(capacity / 64);
+      _present.assign(present, present + capacity / 64);
+      _values = std::move(values);
+      _capacity = capacity;
+      _count = count;
+      readValues(reader, std::is_trivially_copyable<TValue>());
+
+      if (_isSnapshotted)
+        _dirtyChunks.assign((capacity / ColumnSnapshot<TValue>::ChunkSize + 64) / 64, ~uint64_t(0));
+    }
+
+    size_t count() const { return _count; }
+
+    /// Returns the first row at or after \p row which holds a value, or an invalid row.
+    RowId nextPresent(RowId row) const
+    {
+      uint32_t index = row.index;
+      while (index < _capacity)
+      {
+        uint64_t word = _present[index / 64] & (~uint64_t(0) << (index % 64));
+        if (word != 0)
+          return RowId(static_cast<uint32_t>((index & ~63u) + __builtin_ctzll(word)));
+        index = (index & ~63u) + 64;
+      }
+      return RowId();
+    }
+
+  private:
+    Column(const Column&) = delete;
+    Column& operator=(const Column&) = delete;
+
+    void writeValues(CheckpointWriter& writer, std::true_type) const
+    {
+      writer.writeArray(_values.get(), _capacity);
+    }
+
+    void writeValues(CheckpointWriter& writer, std::false_type) const
+    {
+      for (RowId row = nextPresent(RowId(0)); row.isValid(); row = nextPresent(RowId(row.index + 1)))
+        BinaryCodec<TValue>::write(writer, _values[row.index]);
+    }
+
+    void readValues(CheckpointReader& reader, std::true_type)
+    {
+      const TValue* values = reader.readArray<TValue>(_capacity);
+      std::copy(values, values + _capacity, _values.get());
+    }
+
+    void readValues(CheckpointReader& reader, std::false_type)
+    {
+      for (RowId row = nextPresent(RowId(0)); row.isValid(); row = nextPresent(RowId(row.index + 1)))
+        _values[row.index] = BinaryCodec<TValue>::read(reader);
+    }
+
+    static uint64_t bit(uint32_t index) { return uint64_t(1) << (index % 64); }
+
+    void grow(size_t required)
+    {
+      // Capacity is kept a multiple of 64 so that the bitmap covers it exactly
+      size_t capacity = std::max<size_t>(std::max<size_t>(required, _capacity * 2), 64);
+      capacity = (capacity + 63) & ~size_t(63);
+      std::unique_ptr<TValue[]> values(new TValue[capacity]);
+      for (size_t i = 0; i < _capacity; i++)
+        values[i] = std::move(_values[i]);
+      _values = std::move(values);
+      _present.resize(capacity / 64, 0);
+      _capacity = capacity;
+      if (_isSnapshotted)
+        _dirtyChunks.resize((capacity / ColumnSnapshot<TValue>::ChunkSize + 64) / 64, 0);
+    }
+
+    std::unique_ptr<TValue[]> _values;
+    size_t _capacity;
+    std::vector<uint64_t> _present;
+    size_t _count;
+    bool _isSnapshotted;
+    /// A bitmap of the chunks of values changed since the last snapshot
+    std::vector<uint64_t> _dirtyChunks;
+  };
+
+  /// The reverse of a relation: for each remote row, the local rows which relate to it.
+  ///
+  /// Each remote row's local rows form a segment of a single shared array, in the manner of a
+  /// compressed sparse row adjacency list, so fan-out is a contiguous span that is read without
+  /// allocating. Segments are given spare capacity, and one that fills is moved to the end of
+  /// the array with twice the capacity. The array is compacted once more than half of it is
+  /// abandoned, so inserts are amortised O(1). The position of each local row within its
+  /// segment is recorded, so removal is an O(1) swap with the segment's last row.
+  class RelationIndex
+  {
+  public:
+    RelationIndex()
+      : _segments(),
+        _rows(),
+        _positions(),
+        _unused(0)
+    {}
+
+    /// Gets the local rows which relate to \p remoteRow, in no particular order.
+    Span<const RowId> get(RowId remoteRow) const
+    {
+      if (!remoteRow.isValid() || remoteRow.index >= _segments.size())
+        return Span<const RowId>();
+      const Segment& segment = _segments[remoteRow.index];
+      return Span<const RowId>(_rows.data() + segment.begin, segment.size);
+    }
+
+    /// Records that \p localRow relates to \p remoteRow. \p localRow must not currently
+    /// relate to any remote row.
+    void insert(RowId remoteRow, RowId localRow)
+    {
+      assert(remoteRow.isValid() && localRow.isValid());
+
+      if (remoteRow.index >= _segments.size())
+        _segments.resize(remoteRow.index + 1);
+      if (localRow.index >= _positions.size())
+        _positions.resize(localRow.index + 1);
+
+      if (_segments[remoteRow.index].size == _segments[remoteRow.index].capacity)
+        relocate(remoteRow);
+
+      Segment& segment = _segments[remoteRow.index];
+      _rows[segment.begin + segment.size] = localRow;
+      _positions[localRow.index] = segment.size;
+      segment.size++;
+    }
+
+    /// Removes the record that \p localRow relates to \p remoteRow.
+    void erase(RowId remoteRow, RowId localRow)
+    {
+      assert(remoteRow.index < _segments.size() && localRow.index < _positions.size());
+
+      Segment& segment = _segments[remoteRow.index];
+      uint32_t position = _positions[localRow.index];
+      assert(position < segment.size && _rows[segment.begin + position] == localRow);
+
+      RowId last = _rows[segment.begin + segment.size - 1];
+      _rows[segment.begin + position] = last;
+      _positions[last.index] = position;
+      segment.size--;
+    }
+
+    void clear()
+    {
+      _segments.clear();
+      _rows.clear();
+      _positions.clear();
+      _unused = 0;
+    }
+
+    void writeCheckpoint(CheckpointWriter& writer) const
+    {
+      writer.write<uint64_t>(_segments.size());
+      writer.writeArray(_segments.data(), _segments.size());
+      writer.write<uint64_t>(_rows.size());
+      writer.writeArray(_rows.data(), _rows.size());
+      writer.write<uint64_t>(_positions.size());
+      writer.writeArray(_positions.data(), _positions.size());
+      writer.write<uint64_t>(_unused);
+    }
+
+    /// Replaces this index with one written by writeCheckpoint.
+    void readCheckpoint(CheckpointReader& reader)
+    {
+      readArray(reader, _segments);
+      readArray(reader, _rows);
+      readArray(reader, _positions);
+      _unused = reader.read<uint64_t>();
+    }
+
+  private:
+    RelationIndex(const RelationIndex&) = delete;
+    RelationIndex& operator=(const RelationIndex&) = delete;
+
+    struct Segment
+    {
+      Segment() : begin(0), size(0), capacity(0) {}
+
+      uint32_t begin;
+      uint32_t size;
+      uint32_t capacity;
+    };
+
+    template<typename T>
+    static void readArray(CheckpointReader& reader, std::vector<T>& values)
+    {
+      size_t count = reader.read<uint64_t>();
+      const T* begin = reader.readArray<T>(count);
+      values.assign(begin, begin + count);
+    }
+
+    /// Moves the segment of \p remoteRow to the end of the array, doubling its capacity.
+    void relocate(RowId remoteRow)
+    {
+      if (_unused > _rows.size() / 2)
+        compact();
+
+      Segment& segment = _segments[remoteRow.index];
+      uint32_t capacity = std::max<uint32_t>(segment.capacity * 2, 4);
+      uint32_t begin = static_cast<uint32_t>(_rows.size());
+      _rows.resize(_rows.size() + capacity);
+      std::copy(_rows.begin() + segment.begin, _rows.begin() + segment.begin + segment.size, _rows.begin() + begin);
+      _unused += segment.capacity;
+      segment.begin = begin;
+      segment.capacity = capacity;
+    }
+
+    /// Rewrites the array without abandoned space, leaving each segment exactly full.
+    void compact()
+    {
+      std::vector<RowId> rows;
+      rows.reserve(_rows.size() - _unused);
+      for (Segment& segment : _segments)
+      {
+        uint32_t begin = static_cast<uint32_t>(rows.size());
+        rows.insert(rows.end(), _rows.begin() + segment.begin, _rows.begin() + segment.begin + segment.size);
+        segment.begin = begin;
+        segment.capacity = segment.size;
+      }
+      _rows.swap(rows);
+      _unused = 0;
+    }
+
+    std::vector<Segment> _segments;
+    std::vector<RowId> _rows;
+    std::vector<uint32_t> _positions;
+    size_t _unused;
+  };
+
+  /// Controls which changes a subscription is notified of when a domain publishes.
+  enum class Delivery
+  {
+    /// Each key that changed since the previous publish is delivered once, with its current value.
+    Conflated,
+    /// Every value set since the previous publish is delivered, in order, including those
+    /// since superseded.
+    EveryChange
+  };
+
+  /// Controls how changes accumulate while a publisher thread (see Graph::startPublishThread)
+  /// is still delivering earlier changes.
+  enum class BackPressure
+  {
+    /// A change to a key that is still awaiting delivery replaces the earlier change, so at
+    /// most one change per key is held, however far the publisher falls behind.
+    Conflate,
+    /// Every change is held, up to a limit per field, beyond which changes to EveryChange
+    /// subscribers are dropped. Conflated subscribers still receive the latest value per key.
+    Bounded
+  };
+
+  /// Counts and times a field's activity while its domain is instrumented (see
+  /// Graph::setInstrumented). Stats are updated by the threads that compute and publish, and so
+  /// should only be read between cycles.
+  struct FieldStats
+  {
+    /// Gets a monotonic time in nanoseconds, for measuring durations.
+    static uint64_t now()
+    {
+      return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    void reset()
+    {
+      setValueCount = 0;
+      recalculateCount = 0;
+      abortedRecalculateCount = 0;
+      suppressedCount = 0;
+      fanOut.reset();
+      computeNanos.reset();
+      publishNanos.reset();
+    }
+
+    /// Values stored, whether set or calculated
+    uint64_t setValueCount = 0;
+    /// Rows calculated, for a computed field
+    uint64_t recalculateCount = 0;
+    /// Rows not marked for calculation as a dependency could not be resolved or held no value
+    uint64_t abortedRecalculateCount = 0;
+    /// Values not stored as equal to those already held (see TypedFieldBase::setEquality)
+    uint64_t suppressedCount = 0;
+    /// For each changed row and dependant, the number of the dependant's rows marked
+    Histogram fanOut;
+    /// Nanoseconds taken to calculate and store dirty rows, per compute
+    Histogram computeNanos;
+    /// Nanoseconds taken to notify subscribers, per publish
+    Histogram publishNanos;
+  };
+
+  /// Judges two values equal if they differ by no more than a tolerance, for use with
+  /// TypedFieldBase::setEquality on fields of floating point values.
+  template<typename T>
+  struct Tolerance
+  {
+    explicit Tolerance(T tolerance)
+      : tolerance(tolerance)
+    {}
+
+    bool operator()(const T& a, const T& b) const
+    {
+      return a < b ? b - a <= tolerance : a - b <= tolerance;
+    }
+
+    T tolerance;
+  };
+
+  class FieldBase
+  {
+  public:
+    explicit FieldBase(std::string name)
+      : _name(name),
+        _stats()
+    {}
+
+    virtual ~FieldBase() = default;
+
+    virtual DomainBase& getDomain() const = 0;
+    virtual any getValue(const any& key) const = 0;
+    virtual bool hasValue(RowId row) const = 0;
+    virtual any getBoxedValue(RowId row) const = 0;
+    virtual void addDependant(ComputedFieldBase* dependant) = 0;
+
+    std::string getName() const { return _name; }
+
+    virtual void visit(std::function<void(const std::pair<any,any>&)>) = 0;
+
+    virtual std::function<void()> subscribe(std::function<void(const any&,const any&)> callback, Delivery delivery = Delivery::Conflated) = 0;
+
+    /// Subscribes to receive all of a field's changes in a single call per publish, as boxed
+    /// key/value pairs. Returns a function that cancels the subscription.
+    virtual std::function<void()> subscribeBatch(std::function<void(Span<const std::pair<any,any>>)> callback, Delivery delivery = Delivery::Conflated) = 0;
+
+    /// Notifies subscribers of changes made since the previous call.
+    virtual void publishChanges() = 0;
+
+    /// Moves changes made since the previous call into a buffer staged for delivery by a
+    /// publisher thread, applying \p backPressure to changes already staged. Adds the number of
+    /// changes dropped to \p droppedCount. Returns whether changes became staged where none were.
+    virtual bool stagePublication(BackPressure backPressure, size_t maxStagedChanges, size_t& droppedCount) = 0;
+
+    /// Takes the staged changes for delivery, leaving the staging buffer empty.
+    virtual void takeStagedPublication() = 0;
+
+    /// Notifies subscribers of the changes taken by takeStagedPublication. Runs on the publisher
+    /// thread, concurrently with changes being staged.
+    virtual void deliverPublication() = 0;
+
+    /// Completes a drain of queued updates (see Graph::enqueue) or the replay of a cycle of a
+    /// journal, notifying dependants of all values applied to this field by it.
+    virtual void endQueuedValues() = 0;
+
+    /// Copies this field's values for a GraphSnapshot, sharing whatever is unchanged with
+    /// \p previous, the copy made for the snapshot before.
+    virtual std::shared_ptr<const void> snapshotValues(const std::shared_ptr<const void>& previous) = 0;
+
+    /// Writes this field's values to a checkpoint, in a section named for the field.
+    virtual void writeCheckpoint(CheckpointWriter& writer) const = 0;
+
+    /// Replaces this field's values with those of a checkpoint, without notifying dependants or
+    /// subscribers.
+    virtual void readCheckpoint(CheckpointReader& reader) = 0;
+
+    /// Gets a name identifying the types of this field's keys and values.
+    virtual std::string getTypeName() const = 0;
+
+    /// Gets whether this field's keys and values may be written to a checkpoint or journal.
+    virtual bool isBinaryCodable() const = 0;
+
+    /// Records each value stored in this field to \p journal, as \p fieldId followed by the
+    /// key and value, or stops recording if \p journal is null.
+    virtual void setJournal(BinaryWriter* journal, uint32_t fieldId) = 0;
+
+    /// Reads a key and value recorded to a journal and sets it, deferring notification of
+    /// dependants until endQueuedValues is called.
+    virtual void readJournalValue(BinaryReader& reader) = 0;
+
+    /// Starts or stops collecting this field's stats. Stopping discards those collected.
+    virtual void setInstrumented(bool isInstrumented)
+    {
+      if (!isInstrumented)
+        _stats.reset();
+      else if (!_stats)
+        _stats = std::make_unique<FieldStats>();
+    }
+
+    /// Gets this field's stats, or null if it is not instrumented.
+    FieldStats* getStats() const { return _stats.get(); }
+
+  private:
+    std::string _name;
+    std::unique_ptr<FieldStats> _stats;
+  };
+
+  class Params
+  {
+  public:
+    Params(std::map<const DomainBase*,any> keyByDomain,
+           std::map<const FieldBase*,any> valueByField)
+    : _keyByDomain(keyByDomain),
+      _valueByField(valueByField)
+    {}
+
+    template<typename TField>
+    typename TField::ValueType operator()(const TField& field) const
+    {
+      auto it = _valueByField.find(&field);
+      assert(it != _valueByField.end());
+      assert(!it->second.empty());
+      return any_cast<typename TField::ValueType>(it->second);
+    }
+
+    template <typename TField>
+    const typename TField::KeyType& key(const TField& field) const
+    {
+      auto it = _keyByDomain.find(&field.getDomain());
+      assert(it != _keyByDomain.end());
+      return any_cast<typename TField::KeyType>(it->second);
+    }
+
+  private:
+    Params(const Params&) = delete;
+    Params& operator=(const Params&) = delete;
+
+    std::map<const DomainBase*,any> _keyByDomain;
+    std::map<const FieldBase*,any> _valueByField;
+  };
+
+  template<typename TValue, typename TKey>
+  class TypedFieldBase : public virtual FieldBase
+  {
+  public:
+    typedef TValue ValueType;
+    typedef TKey KeyType;
+
+    /// Iterates the keys of a field that hold values, in row order. Dereferences to a
+    /// pair of references into the domain's key table and the field's value column.
+    class const_iterator
+    {
+    public:
+      typedef std::forward_iterator_tag iterator_category;
+      typedef std::pair<const TKey&,const TValue&> value_type;
+      typedef std::ptrdiff_t difference_type;
+      typedef value_type reference;
+
+      struct pointer
+      {
+        value_type pair;
+        const value_type* operator->() const { return &pair; }
+      };
+
+      const_iterator(const TypedFieldBase* field, RowId row)
+        : _field(field),
+          _row(row)
+      {}
+
+      RowId row() const { return _row; }
+
+      reference operator*() const
+      {
+        return value_type(_field->_domain.getKey(_row), _field->_values.get(_row));
+      }
+
+      pointer operator->() const { return pointer{**this}; }
+
+      const_iterator& operator++()
+      {
+        _row = _field->_values.nextPresent(RowId(_row.index + 1));
+        return *this;
+      }
+
+      const_iterator operator++(int)
+      {
+        const_iterator prior = *this;
+        ++*this;
+        return prior;
+      }
+
+      bool operator==(const const_iterator& other) const { return _row == other._row && _field == other._field; }
+      bool operator!=(const const_iterator& other) const { return !(*this == other); }
+
+    private:
+      const TypedFieldBase* _field;
+      RowId _row;
+    };
+
+    TypedFieldBase(std::string name, Domain<TKey>& domain)
+      : FieldBase(name),
+        _domain(domain),
+        _values(),
+        _observers(),
+        _keyedObservers(),
+        _observersByRow(),
+        _unboundKeys(),
+        _pendingKeys(),
+        _pendingObservers(),
+        _pendingKeyCount(0),
+        _conflatedObserverCount(0),
+        _everyChangeObserverCount(0),
+        _conflatedBatchObserverCount(0),
+        _everyChangeBatchObserverCount(0),
+        _deliveringDepth(0),
+        _hasCancelledObservers(false),
+        _observerVersion(0),
+        _recordingVersion(0),
+        _recordingAll(0),
+        _recordingByRow(),
+        _hasPendingKeys(false),
+        _boundRowCount(0),
+        _changedRows(),
+        _publishingRows(),
+        _changeLog(),
+        _publishingLog(),
+        _batch(),
+        _observerMutex(),
+        _staged(),
+        _delivering(),
+        _stagedConflatedPositions(),
+        _stagedEveryChangePositions(),
+        _deliveryBatch(),
+        _dependantComputations(),
+        _deferredRows(),
+        _queuedRows(),
+        _journal(nullptr),
+        _journalFieldId(0),
+        _isEqual()
+    {}
+
+    ~TypedFieldBase() override = default;
+
+    std::function<void()> subscribe(std::function<void(const any&,const any&)> observer, Delivery delivery = Delivery::Conflated) override
+    {
+      return subscribe([observer](const TKey& key,const TValue& value)
+      {
+        any anyKey = key;
+        any anyValue = value;
+        observer(anyKey, anyValue);
+      }, delivery);
+    }
+
+    std::function<void()> subscribe(std::function<void(const TKey&,const TValue&)> observer, Delivery delivery = Delivery::Conflated)
+    {
+      return addObserver(Observer{observer, nullptr, delivery});
+    }
+
+    /// Subscribes to changes of only the given \p keys. The field indexes such subscriptions by
+    /// key, so a change invokes only the observers of that key, and changes to keys that no
+    /// observer is interested in are not recorded for publication at all.
+    ///
+    /// Subscribing does not add keys to the domain. Keys are bound to their rows by the graph
+    /// thread when it next records a change to this field, and keys the domain has not yet seen
+    /// are held pending until the domain first assigns them a row.
+    std::function<void()> subscribe(const std::vector<TKey>& keys, std::function<void(const TKey&,const TValue&)> observer, Delivery delivery = Delivery::Conflated)
+    {
+      static std::atomic<ulong> nextKeyedObserverId(0);
+      ulong observerId = nextKeyedObserverId++;
+
+      std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+      KeyedObserver& keyed = _keyedObservers[observerId];
+      keyed.observer = Observer{observer, nullptr, delivery};
+      // Keys are not looked up here, as the domain may only be read by the graph thread
+      for (auto const& key : keys)
+        _unboundKeys.emplace_back(&keyed, key);
+      _observerVersion++;
+
+      // Return a function that cancels the subscription when invoked
+      return [this,observerId]
+      {
+        std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+        auto it = _keyedObservers.find(observerId);
+        assert(it != _keyedObservers.end());
+        if (_deliveringDepth != 0)
+        {
+          // Observers are being notified, so the subscription is removed once they have been
+          it->second.observer.isCancelled = true;
+          _hasCancelledObservers = true;
         }
         else
         {
-          dependencyKey = keyIt->second;
-//          std::cout << "      dependencyKey found for " << dependency->getName() << " (same domain): " << dependencyKey << std::endl;
+          removeKeyedObserver(it);
         }
+        _observerVersion++;
+      };
+    }
+
+    /// A change delivered to batch subscribers, referring to the key and value in place.
+    struct Change
+    {
+      const TKey& key;
+      const TValue& value;
+    };
+
+    /// Subscribes to receive all of this field's changes in a single call per publish, as a
+    /// contiguous span. The span, and the references within it, are valid only during the call.
+    /// Returns a function that cancels the subscription.
+    std::function<void()> subscribeBatch(std::function<void(Span<const Change>)> observer, Delivery delivery = Delivery::Conflated)
+    {
+      return addObserver(Observer{nullptr, observer, delivery});
+    }
+
+    std::function<void()> subscribeBatch(std::function<void(Span<const std::pair<any,any>>)> observer, Delivery delivery = Delivery::Conflated) override
+    {
+      // Boxed changes are held in a buffer that is reused for every publish
+      auto boxed = std::make_shared<std::vector<std::pair<any,any>>>();
+      return subscribeBatch([observer,boxed](Span<const Change> changes)
+      {
+        boxed->clear();
+        for (auto const& change : changes)
+          boxed->emplace_back(any(change.key), any(change.value));
+        observer(*boxed);
+      }, delivery);
+    }
+
+    DomainBase& getDomain() const override
+    {
+      return _domain;
+    }
+
+    void addDependant(ComputedFieldBase* dependant) override
+    {
+      _dependantComputations.insert(dependant);
+    }
+
+    std::set<ComputedFieldBase*>& getDependants() { return _dependantComputations; }
+
+    /// Suppresses values which \p isEqual judges equal to the value already held for their key,
+    /// so that they are not stored, do not mark dependants for recalculation and are not
+    /// published. This cuts off the propagation of results that a rounding or clamping
+    /// calculation leaves unchanged. For example:
+    ///
+    ///     rounded.setEquality(std::equal_to<double>());
+    ///     px.setEquality(Tolerance<double>(1e-9));
+    ///
+    /// By default, and after passing null, every value set is propagated.
+    void setEquality(std::function<bool(const TValue&,const TValue&)> isEqual)
+    {
+      _isEqual = std::move(isEqual);
+    }
+
+    void setValue(const TKey& key, const TValue& value)
+    {
+      setValue(_domain.getOrAddRow(key), value);
+    }
+
+    void setValue(RowId row, const TValue& value)
+    {
+      if (isUnchanged(row, value))
+        return;
+
+      storeValue(row, value);
+
+      // If any computed properties depend upon this, set 'computation required' and store relevant data
+      if (!_dependantComputations.empty())
+        _domain.onComputationInputChanged(*this, Span<const RowId>(&row, 1));
+
+      recordChange(row, value);
+    }
+
+    /// Sets the value of many keys at once from a range of key/value pairs, such as a
+    /// std::vector<std::pair<TKey,TValue>> or a std::map<TKey,TValue>. Dependants are notified
+    /// once for the whole batch, with each changed row visited once however often it appears.
+    template<typename TPairs>
+    void setValues(const TPairs& pairs)
+    {
+      for (auto const& pair : pairs)
+        setValueDeferred(_domain.getOrAddRow(std::get<0>(pair)), std::get<1>(pair));
+      propagateDeferred();
+    }
+
+    /// Claims \p row for a queued update, while draining updates newest first. Returns false
+    /// if a newer update for the same row has already claimed it, in which case this update is
+    /// superseded. \p isFirst is set if this is the first claim upon this field in the drain.
+    bool claimQueuedRow(RowId row, bool& isFirst)
+    {
+      isFirst = _queuedRows.empty();
+      return _queuedRows.insert(row);
+    }
+
+    /// Applies the value of a queued update, deferring notification of dependants until
+    /// endQueuedValues is called.
+    void applyQueuedValue(RowId row, const TValue& value)
+    {
+      setValueDeferred(row, value);
+    }
+
+    void endQueuedValues() override
+    {
+      _queuedRows.clear();
+      propagateDeferred();
+    }
+
+    /// Sets the value of many keys at once from parallel columns of keys and values.
+    void setValues(Span<const TKey> keys, Span<const TValue> values)
+    {
+      assert(keys.size() == values.size());
+      for (size_t i = 0; i < keys.size(); i++)
+        setValueDeferred(_domain.getOrAddRow(keys[i]), values[i]);
+      propagateDeferred();
+    }
+
+    TValue getValue(const TKey key) const
+    {
+      auto it = find(key);
+      if (it == end())
+        throw std::runtime_error("No value exists for key");
+      return it->second;
+    }
+
+    const TValue& getValue(RowId row) const
+    {
+      if (!_values.has(row))
+        throw std::runtime_error("No value exists for row");
+      return _values.get(row);
+    }
+
+    any getValue(const any& key) const override
+    {
+      const TKey& k = any_cast<TKey>(key);
+      auto it = find(k);
+      return it == end() ? any() : it->second;
+    }
+
+    bool hasValue(RowId row) const override
+    {
+      return _values.has(row);
+    }
+
+    any getBoxedValue(RowId row) const override
+    {
+      return _values.has(row) ? any(_values.get(row)) : any();
+    }
+
+    const_iterator find(const TKey& key) const
+    {
+      return find(_domain.findRow(key));
+    }
+
+    const_iterator find(RowId row) const
+    {
+      return row.isValid() && _values.has(row) ? const_iterator(this, row) : end();
+    }
+
+    const_iterator begin() const { return const_iterator(this, _values.nextPresent(RowId(0))); }
+
+    const_iterator end() const { return const_iterator(this, RowId()); }
+
+    size_t count() const { return _values.count(); }
+
+    void notifyObservers(const TKey& key, const TValue& value)
+    {
+      std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+      _deliveringDepth++;
+      for (auto& pair : _observers)
+        if (pair.second.callback && !pair.second.isCancelled)
+          pair.second.callback(key, value);
+      RowId row = _domain.findRow(key);
+      if (row.isValid())
+        for (const Observer* observer : keyedObservers(row))
+          if (!observer->isCancelled)
+            observer->callback(key, value);
+      endDelivery();
+    }
+
+    void publishChanges() override
+    {
+      uint64_t start = getStats() != nullptr ? FieldStats::now() : 0;
+
+      // Observers may set values, so changes made while publishing are kept for the next publish
+      _publishingRows.swap(_changedRows);
+      _publishingLog.swap(_changeLog);
+
+      std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+      _deliveringDepth++;
+
+      for (RowId row : _publishingRows)
+        notifyChange(Delivery::Conflated, row, _domain.getKey(row), _values.get(row), _batch);
+      notifyBatchObservers(Delivery::Conflated, _batch);
+
+      for (auto const& change : _publishingLog)
+        notifyChange(Delivery::EveryChange, change.first, _domain.getKey(change.first), change.second, _batch);
+      notifyBatchObservers(Delivery::EveryChange, _batch);
+      endDelivery();
+
+      _publishingRows.clear();
+      _publishingLog.clear();
+
+      if (FieldStats* stats = getStats())
+        stats->publishNanos.record(FieldStats::now() - start);
+    }
+
+    bool stagePublication(BackPressure backPressure, size_t maxStagedChanges, size_t& droppedCount) override
+    {
+      bool wasStaged = !_staged.conflated.empty() || !_staged.everyChange.empty();
+
+      // Keys and values are copied, as the publisher thread may not read the domain or column
+      for (RowId row : _changedRows)
+        stageChange(_staged.conflated, _stagedConflatedPositions, row, _values.get(row), true);
+
+      for (auto const& change : _changeLog)
+      {
+        if (backPressure == BackPressure::Conflate)
+        {
+          // Changes are only conflated once the publisher has fallen behind
+          stageChange(_staged.everyChange, _stagedEveryChangePositions, change.first, change.second, wasStaged);
+        }
+        else if (_staged.everyChange.size() < maxStagedChanges)
+        {
+          _staged.everyChange.push_back(StagedChange{change.first, _domain.getKey(change.first), change.second});
+        }
+        else
+        {
+          droppedCount++;
+        }
+      }
+
+      _changedRows.clear();
+      _changeLog.clear();
+
+      return !wasStaged && (!_staged.conflated.empty() || !_staged.everyChange.empty());
+    }
+
+    void takeStagedPublication() override
+    {
+      assert(_delivering.conflated.empty() && _delivering.everyChange.empty());
+
+      for (auto const& change : _staged.conflated)
+        _stagedConflatedPositions[change.row.index] = 0;
+      for (auto const& change : _staged.everyChange)
+        if (change.row.index < _stagedEveryChangePositions.size())
+          _stagedEveryChangePositions[change.row.index] = 0;
+
+      std::swap(_staged, _delivering);
+    }
+
+    void deliverPublication() override
+    {
+      std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+      _deliveringDepth++;
+      uint64_t start = getStats() != nullptr ? FieldStats::now() : 0;
+
+      for (auto const& change : _delivering.conflated)
+        notifyChange(Delivery::Conflated, change.row, change.key, change.value, _deliveryBatch);
+      notifyBatchObservers(Delivery::Conflated, _deliveryBatch);
+
+      for (auto const& change : _delivering.everyChange)
+        notifyChange(Delivery::EveryChange, change.row, change.key, change.value, _deliveryBatch);
+      notifyBatchObservers(Delivery::EveryChange, _deliveryBatch);
+      endDelivery();
+
+      _delivering.conflated.clear();
+      _delivering.everyChange.clear();
+
+      if (FieldStats* stats = getStats())
+        stats->publishNanos.record(FieldStats::now() - start);
+    }
+
+    std::shared_ptr<const void> snapshotValues(const std::shared_ptr<const void>& previous) override
+    {
+      return _values.snapshot(std::static_pointer_cast<const ColumnSnapshot<TValue>>(previous));
+    }
+
+    void writeCheckpoint(CheckpointWriter& writer) const override
+    {
+      writer.beginSection(getName(), typeid(TValue).name());
+      _values.writeCheckpoint(writer);
+    }
+
+    void readCheckpoint(CheckpointReader& reader) override
+    {
+      reader.expectSection(getName(), typeid(TValue).name());
+      _values.readCheckpoint(reader);
+    }
+
+    std::string getTypeName() const override
+    {
+      return typeid(std::pair<TKey,TValue>).name();
+    }
+
+    bool isBinaryCodable() const override
+    {
+      return IsBinaryCodable<TKey>::value && IsBinaryCodable<TValue>::value;
+    }
+
+    void setJournal(BinaryWriter* journal, uint32_t fieldId) override
+    {
+      _journal = journal;
+      _journalFieldId = fieldId;
+    }
+
+    void readJournalValue(BinaryReader& reader) override
+    {
+      TKey key = BinaryCodec<TKey>::read(reader);
+      TValue value = BinaryCodec<TValue>::read(reader);
+      setValueDeferred(_domain.getOrAddRow(key), value);
+    }
+
+    void visit(std::function<void(const std::pair<any,any>&)> visitor) override
+    {
+      for (auto const& pair : *this)
+      {
+        std::pair<any,any> anyPair(pair.first, pair.second);
+        visitor(anyPair);
+      }
+    }
+
+  protected:
+    /// Stores \p value in \p row, without notifying dependants or observers.
+    virtual void storeValue(RowId row, const TValue& value)
+    {
+      // Journal the value first, so that a failure to record it leaves the field unchanged
+      if (_journal != nullptr)
+      {
+        _journal->write(_journalFieldId);
+        BinaryCodec<TKey>::write(*_journal, _domain.getKey(row));
+        BinaryCodec<TValue>::write(*_journal, value);
+      }
+
+      _values.set(row, value);
+
+      if (FieldStats* stats = getStats())
+        stats->setValueCount++;
+    }
+
+    /// Stores \p value in \p row, deferring notification of dependants until
+    /// propagateDeferred is called.
+    void setValueDeferred(RowId row, const TValue& value)
+    {
+      if (isUnchanged(row, value))
+        return;
+
+      storeValue(row, value);
+      if (!_dependantComputations.empty())
+        _deferredRows.insert(row);
+      recordChange(row, value);
+    }
+
+    /// Notifies dependants of all rows changed by setValueDeferred since the previous call.
+    void propagateDeferred()
+    {
+      if (_deferredRows.empty())
+        return;
+      _domain.onComputationInputChanged(*this, _deferredRows.getRows());
+      _deferredRows.clear();
+    }
+
+  private:
+    TypedFieldBase(const TypedFieldBase&) = delete;
+    TypedFieldBase& operator=(const TypedFieldBase&) = delete;
+
+    /// Gets whether \p value is judged equal to the value \p row already holds, and so should
+    /// be suppressed.
+    bool isUnchanged(RowId row, const TValue& value) const
+    {
+      if (!_isEqual || !_values.has(row) || !_isEqual(_values.get(row), value))
+        return false;
+      if (FieldStats* stats = getStats())
+        stats->suppressedCount++;
+      return true;
+    }
+
+    /// If any clients have subscribed, sets 'publish required' and records the change.
+    void recordChange(RowId row, const TValue& value)
+    {
+      refreshRecording(row);
+      uint8_t recording = _recordingAll;
+      if (row.index < _recordingByRow.size())
+        recording |= _recordingByRow[row.index];
+      bool conflated = (recording & recordingFlag(Delivery::Conflated)) != 0;
+      bool everyChange = (recording & recordingFlag(Delivery::EveryChange)) != 0;
+
+      if (!conflated && !everyChange)
+        return;
+
+      bool wasPending = !_changedRows.empty() || !_changeLog.empty();
+      if (conflated)
+        _changedRows.insert(row);
+      if (everyChange)
+        _changeLog.emplace_back(row, value);
+      if (!wasPending)
+        _domain.addPublishField(this);
+    }
+
+
+    Domain<TKey>& _domain;
+    Column<TValue> _values;
+    /// An observer receives either each change via callback, or all changes via batchCallback.
+    struct Observer
+    {
+      std::function<void(const TKey&,const TValue&)> callback;
+      std::function<void(Span<const Change>)> batchCallback;
+      Delivery delivery;
+      /// Set when unsubscribed during delivery, until the observer can be removed
+      bool isCancelled = false;
+    };
+
+    /// A subscription to the keys of the given rows, and to keys yet to be assigned a row.
+    struct KeyedObserver
+    {
+      Observer observer;
+      std::vector<RowId> rows;
+      std::vector<TKey> pendingKeys;
+    };
+
+    size_t& observerCount(Delivery delivery)
+    {
+      return delivery == Delivery::Conflated ? _conflatedObserverCount : _everyChangeObserverCount;
+    }
+
+    size_t& batchObserverCount(Delivery delivery)
+    {
+      return delivery == Delivery::Conflated ? _conflatedBatchObserverCount : _everyChangeBatchObserverCount;
+    }
+
+    /// Gets the bit of _recordingAll and _recordingByRow for changes to be delivered by \p delivery.
+    static uint8_t recordingFlag(Delivery delivery)
+    {
+      return delivery == Delivery::Conflated ? 1 : 2;
+    }
+
+    /// Gets the observers subscribed to the key of \p row alone. Must be called with
+    /// _observerMutex held.
+    Span<const Observer* const> keyedObservers(RowId row) const
+    {
+      if (row.index >= _observersByRow.size())
+        return Span<const Observer* const>();
+      return Span<const Observer* const>(_observersByRow[row.index]);
+    }
+
+    /// Brings the graph thread's copy of which changes to record up to date with subscriptions,
+    /// which other threads may change, and binds keyed subscriptions to rows. Runs on the graph
+    /// thread, and takes _observerMutex only once subscriptions have changed, or \p row is one
+    /// the domain has assigned since pending keys were last bound.
+    void refreshRecording(RowId row)
+    {
+      bool isNewRow = _hasPendingKeys && row.index >= _boundRowCount;
+      if (!isNewRow && _observerVersion.load(std::memory_order_acquire) == _recordingVersion)
+        return;
+
+      std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+
+      _recordingAll = 0;
+      if (_conflatedObserverCount != 0)
+        _recordingAll |= recordingFlag(Delivery::Conflated);
+      if (_everyChangeObserverCount != 0)
+        _recordingAll |= recordingFlag(Delivery::EveryChange);
+
+      // Keyed observers may not be moved while observers are being notified, so their
+      // subscriptions are bound once the delivery ends
+      if (_deliveringDepth != 0)
+        return;
+
+      uint64_t version = _observerVersion.load(std::memory_order_relaxed);
+      bindKeys();
+      if (version != _recordingVersion)
+      {
+        _recordingVersion = version;
+        _recordingByRow.assign(_observersByRow.size(), 0);
+        for (size_t i = 0; i < _observersByRow.size(); i++)
+          for (const Observer* observer : _observersByRow[i])
+            if (!observer->isCancelled)
+              _recordingByRow[i] |= recordingFlag(observer->delivery);
+      }
+      _hasPendingKeys = _pendingKeyCount != 0;
+    }
+
+    /// Gets the observers waiting for the key at \p index of _pendingKeys to be assigned a row.
+    std::vector<KeyedObserver*>& pendingObservers(RowId index)
+    {
+      assert(index.isValid());
+      if (index.index >= _pendingObservers.size())
+        _pendingObservers.resize(index.index + 1);
+      return _pendingObservers[index.index];
+    }
+
+    /// Adds \p keyed to the observers of \p row.
+    void bindKey(KeyedObserver& keyed, RowId row)
+    {
+      if (std::find(keyed.rows.begin(), keyed.rows.end(), row) != keyed.rows.end())
+        return;
+      keyed.rows.push_back(row);
+      if (row.index >= _observersByRow.size())
+        _observersByRow.resize(row.index + 1);
+      _observersByRow[row.index].push_back(&keyed.observer);
+      if (row.index >= _recordingByRow.size())
+        _recordingByRow.resize(row.index + 1, 0);
+      if (!keyed.observer.isCancelled)
+        _recordingByRow[row.index] |= recordingFlag(keyed.observer.delivery);
+    }
+
+    /// Looks up the keys of new keyed subscriptions, holding those the domain has not yet seen
+    /// as pending, then binds pending keys to any of the rows the domain has assigned since the
+    /// previous call. Runs on the graph thread, with _observerMutex held.
+    void bindKeys()
+    {
+      for (auto& unbound : _unboundKeys)
+      {
+        KeyedObserver& keyed = *unbound.first;
+        RowId row = _domain.findRow(unbound.second);
+        if (row.isValid())
+        {
+          bindKey(keyed, row);
+          continue;
+        }
+        auto& pending = pendingObservers(_pendingKeys.insert(unbound.second));
+        if (std::find(pending.begin(), pending.end(), &keyed) != pending.end())
+          continue;
+        if (pending.empty())
+          _pendingKeyCount++;
+        pending.push_back(&keyed);
+        keyed.pendingKeys.push_back(std::move(unbound.second));
+      }
+      _unboundKeys.clear();
+
+      size_t rowCount = _domain.getRowCount();
+      for (size_t i = _boundRowCount; i < rowCount && _pendingKeyCount != 0; i++)
+      {
+        RowId row(static_cast<uint32_t>(i));
+        RowId index = _pendingKeys.find(_domain.getKey(row));
+        if (!index.isValid())
+          continue;
+        auto& pending = pendingObservers(index);
+        if (pending.empty())
+          continue;
+        for (KeyedObserver* keyed : pending)
+          bindKey(*keyed, row);
+        pending.clear();
+        _pendingKeyCount--;
+      }
+      _boundRowCount = rowCount;
+    }
+
+    /// Removes a keyed subscription from every index. Must be called with _observerMutex held,
+    /// and not while observers are being notified.
+    void removeKeyedObserver(typename std::map<ulong,KeyedObserver>::iterator it)
+    {
+      KeyedObserver* keyed = &it->second;
+      for (RowId row : keyed->rows)
+      {
+        auto& observers = _observersByRow[row.index];
+        observers.erase(std::find(observers.begin(), observers.end(), &keyed->observer));
+      }
+      for (auto const& key : keyed->pendingKeys)
+      {
+        // The key may have been bound since, in which case it is no longer pending
+        auto& pending = pendingObservers(_pendingKeys.find(key));
+        auto pendingIt = std::find(pending.begin(), pending.end(), keyed);
+        if (pendingIt == pending.end())
+          continue;
+        pending.erase(pendingIt);
+        if (pending.empty())
+          _pendingKeyCount--;
+      }
+      _unboundKeys.erase(
+        std::remove_if(_unboundKeys.begin(), _unboundKeys.end(), [keyed](const std::pair<KeyedObserver*,TKey>& unbound) { return unbound.first == keyed; }),
+        _unboundKeys.end());
+      _keyedObservers.erase(it);
+    }
+
+    /// Ends a delivery begun by incrementing _deliveringDepth, removing the subscriptions
+    /// cancelled during it once no delivery remains. Must be called with _observerMutex held.
+    void endDelivery()
+    {
+      assert(_deliveringDepth != 0);
+      if (--_deliveringDepth != 0 || !_hasCancelledObservers)
+        return;
+      _hasCancelledObservers = false;
+      for (auto it = _observers.begin(); it != _observers.end(); )
+        it = it->second.isCancelled ? _observers.erase(it) : std::next(it);
+      for (auto it = _keyedObservers.begin(); it != _keyedObservers.end(); )
+      {
+        auto next = std::next(it);
+        if (it->second.observer.isCancelled)
+          removeKeyedObserver(it);
+        it = next;
+      }
+    }
+
+    std::function<void()> addObserver(Observer observer)
+    {
+      // Give each subscription an ID. This allows removal of the subscription later.
+      // This is because std::function is not comparable.
+      static std::atomic<ulong> nextObserverId(0);
+      ulong observerId = nextObserverId++;
+
+      Delivery delivery = observer.delivery;
+      bool isBatch = static_cast<bool>(observer.batchCallback);
+      std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+      _observers.emplace(observerId, std::move(observer));
+      observerCount(delivery)++;
+      if (isBatch)
+        batchObserverCount(delivery)++;
+      _observerVersion++;
+
+      // Return a function that cancels the subscription when invoked
+      return [this,observerId,delivery,isBatch]
+      {
+        std::lock_guard<std::recursive_mutex> lock(_observerMutex);
+        auto it = _observers.find(observerId);
+        assert(it != _observers.end());
+        if (_deliveringDepth != 0)
+        {
+          // Observers are being notified, so the subscription is removed once they have been
+          it->second.isCancelled = true;
+          _hasCancelledObservers = true;
+        }
+        else
+        {
+          _observers.erase(it);
+        }
+        observerCount(delivery)--;
+        if (isBatch)
+          batchObserverCount(delivery)--;
+        _observerVersion++;
+      };
+    }
+
+    /// Invokes the per-key observers of \p delivery with a change to the key of \p row, and
+    /// gathers the change into \p batch if there are batch observers of \p delivery.
+    void notifyChange(Delivery delivery, RowId row, const TKey& key, const TValue& value, std::vector<Change>& batch)
+    {
+      for (auto& pair : _observers)
+        if (pair.second.delivery == delivery && pair.second.callback && !pair.second.isCancelled)
+          pair.second.callback(key, value);
+      for (const Observer* observer : keyedObservers(row))
+        if (observer->delivery == delivery && !observer->isCancelled)
+          observer->callback(key, value);
+      if (batchObserverCount(delivery) != 0)
+        batch.push_back(Change{key, value});
+    }
+
+    /// Delivers the changes gathered in \p batch to batch observers of \p delivery.
+    void notifyBatchObservers(Delivery delivery, std::vector<Change>& batch)
+    {
+      if (batch.empty())
+        return;
+      for (auto& pair : _observers)
+        if (pair.second.delivery == delivery && pair.second.batchCallback && !pair.second.isCancelled)
+          pair.second.batchCallback(Span<const Change>(batch));
+      batch.clear();
+    }
+
+    /// A change copied for delivery on a publisher thread.
+    struct StagedChange
+    {
+      RowId row;
+      TKey key;
+      TValue value;
+    };
+
+    struct Publication
+    {
+      std::vector<StagedChange> conflated;
+      std::vector<StagedChange> everyChange;
+    };
+
+    /// Appends a change to \p changes, or if \p replace is set and \p changes already holds a
+    /// change to \p row, replaces its value. \p positions records one past the position of
+    /// each row's latest change.
+    void stageChange(std::vector<StagedChange>& changes, std::vector<uint32_t>& positions, RowId row, const TValue& value, bool replace)
+    {
+      if (row.index >= positions.size())
+        positions.resize(row.index + 1, 0);
+      uint32_t& position = positions[row.index];
+      if (replace && position != 0)
+      {
+        changes[position - 1].value = value;
+        return;
+      }
+      changes.push_back(StagedChange{row, _domain.getKey(row), value});
+      position = static_cast<uint32_t>(changes.size());
+    }
+
+    // Subscriptions may be made and cancelled on any thread, including by observers running on
+    // a publisher thread, so the members from here to _observerVersion are guarded by
+    // _observerMutex.
+
+    /// Subscriptions to all keys
+    std::map<ulong,Observer> _observers;
+    /// Subscriptions to particular keys, indexed by row in _observersByRow
+    std::map<ulong,KeyedObserver> _keyedObservers;
+    std::vector<std::vector<const Observer*>> _observersByRow;
+    /// Keys of keyed subscriptions yet to be looked up in the domain by the graph thread
+    std::vector<std::pair<KeyedObserver*,TKey>> _unboundKeys;
+    /// Keys subscribed to before the domain assigned them a row. Each key's index in
+    /// _pendingKeys indexes its waiting observers in _pendingObservers.
+    KeyDictionary<TKey> _pendingKeys;
+    std::vector<std::vector<KeyedObserver*>> _pendingObservers;
+    size_t _pendingKeyCount;
+    size_t _conflatedObserverCount;
+    size_t _everyChangeObserverCount;
+    size_t _conflatedBatchObserverCount;
+    size_t _everyChangeBatchObserverCount;
+    /// The number of deliveries in progress, during which observers are not removed
+    unsigned _deliveringDepth;
+    bool _hasCancelledObservers;
+    /// Incremented whenever subscriptions change
+    std::atomic<uint64_t> _observerVersion;
+
+    // The graph thread's copy of which changes to record, read without locking by recordChange.
+
+    /// The _observerVersion the copy was made from
+    uint64_t _recordingVersion;
+    /// The recordingFlag of each Delivery for which a change to any key is recorded
+    uint8_t _recordingAll;
+    /// The recordingFlag of each Delivery for which a change to a row is recorded
+    std::vector<uint8_t> _recordingByRow;
+    bool _hasPendingKeys;
+    /// The number of the domain's rows that have been checked against _pendingKeys
+    size_t _boundRowCount;
+
+    RowSet _changedRows;
+    RowSet _publishingRows;
+    std::vector<std::pair<RowId,TValue>> _changeLog;
+    std::vector<std::pair<RowId,TValue>> _publishingLog;
+    std::vector<Change> _batch;
+    /// Guards observers while a publisher thread delivers to them
+    std::recursive_mutex _observerMutex;
+    Publication _staged;
+    Publication _delivering;
+    std::vector<uint32_t> _stagedConflatedPositions;
+    std::vector<uint32_t> _stagedEveryChangePositions;
+    std::vector<Change> _deliveryBatch;
+    std::set<ComputedFieldBase*> _dependantComputations;
+    RowSet _deferredRows;
+    RowSet _queuedRows;
+    BinaryWriter* _journal;
+    uint32_t _journalFieldId;
+    std::function<bool(const TValue&,const TValue&)> _isEqual;
+  };
+
+  class ComputedFieldBase
+  {
+  public:
+    virtual ~ComputedFieldBase() = default;
+
+    virtual DomainBase& getDomain() const = 0;
+
+    /// Marks \p row for calculation during the next compute, provided all of its dependencies
+    /// can be resolved and hold values. Returns whether the row could be calculated.
+    ///
+    /// Rows are only marked once per compute cycle, however many times their inputs change,
+    /// and values are read when the calculation runs.
+    bool recalculate(RowId row)
+    {
+      assert(row.isValid());
+
+      if (!canCalculate(row))
+      {
+        if (_stats != nullptr)
+          _stats->abortedRecalculateCount++;
+        return false;
+      }
+
+      if (_dirtyRows.insert(row) && _dirtyRows.size() == 1)
+        onDirty();
+
+      return true;
+    }
+
+    /// Marks \p row for calculation because \p input, one of its dependencies or a relation
+    /// used to reach them, has changed. Returns whether the row could be calculated. Fields
+    /// that hold state per row override this to observe each change as it happens.
+    virtual bool onInputChanged(const FieldBase& input, RowId row)
+    {
+      (void)input;
+      return recalculate(row);
+    }
+
+    /// Gets whether any rows are awaiting calculation.
+    bool isDirty() const { return !_dirtyRows.empty(); }
+
+    /// Gets the number of rows awaiting calculation.
+    size_t getDirtyCount() const { return _dirtyRows.size(); }
+
+    /// Calculates all rows marked since the previous call. Rows marked while this runs are
+    /// retained for the next call.
+    void computeDirty()
+    {
+      if (_dirtyRows.empty())
+        return;
+      _computeStart = _stats != nullptr ? FieldStats::now() : 0;
+      _computingRows.swap(_dirtyRows);
+      onClean();
+      prepareResults(_computingRows.size());
+      calculateResults(_computingRows, 0, _computingRows.size());
+      storeResults(_computingRows);
+      onComputed();
+    }
+
+    /// Begins a compute in which rows are calculated concurrently. Rows marked since the
+    /// previous compute are numbered from zero, and the count of them returned. Once
+    /// computeRange has been called for every number, endConcurrentCompute stores the results.
+    size_t beginConcurrentCompute()
+    {
+      if (_dirtyRows.empty())
+        return 0;
+      _computeStart = _stats != nullptr ? FieldStats::now() : 0;
+      _computingRows.swap(_dirtyRows);
+      onClean();
+      prepareResults(_computingRows.size());
+      return _computingRows.size();
+    }
+
+    /// Calculates the rows numbered [begin, end) without storing them. May be called from
+    /// several threads at once, provided the ranges do not overlap.
+    void computeRange(size_t begin, size_t end)
+    {
+      assert(begin <= end && end <= _computingRows.size());
+      calculateResults(_computingRows, begin, end);
+    }
+
+    /// Stores the results calculated by computeRange, in the order their rows were marked.
+    void endConcurrentCompute()
+    {
+      storeResults(_computingRows);
+      onComputed();
+    }
+
+    const std::set<FieldBase*>& getDependencies() const { return _dependencies; }
+
+    /// Gets whether this field aggregates the rows of a domain related to its own, in which
+    /// case changes to its dependencies are passed to aggregateRows rather than recalculate.
+    bool isAggregate() const { return _isAggregate; }
+
+    /// Applies changes to \p rows of the aggregated domain, marking the rows of this field's
+    /// domain whose aggregates they change for calculation.
+    virtual void aggregateRows(Span<const RowId> rows)
+    {
+      (void)rows;
+      assert(false);
+    }
+
+    /// Gets this field's position in the dependency order. Computed fields have a level one
+    /// greater than the highest level amongst their dependencies and the relations used to
+    /// reach them, where fields that are not computed have level zero. Calculating in order
+    /// of ascending level therefore calculates each field after all of its inputs.
+    unsigned getLevel() const { return _level; }
+
+    void setLevel(unsigned level) { _level = level; }
+
+  protected:
+    explicit ComputedFieldBase(std::set<FieldBase*> dependencies, bool isAggregate = false)
+      : _dependencies(dependencies),
+        _isAggregate(isAggregate),
+        _level(1),
+        _dirtyRows(),
+        _computingRows(),
+        _stats(nullptr),
+        _computeStart(0)
+    {}
+
+    /// Sets the stats of the field, or null if it is not instrumented.
+    void setStats(FieldStats* stats) { _stats = stats; }
+
+    /// Gets whether all dependencies of \p row can be resolved and hold values.
+    virtual bool canCalculate(RowId row) const = 0;
+
+    /// Allocates space for the results of \p count rows.
+    virtual void prepareResults(size_t count) = 0;
+
+    /// Calculates the values of \p rows numbered [begin, end) from the current values of their
+    /// dependencies, retaining them by number until storeResults is called.
+    virtual void calculateResults(const RowSet& rows, size_t begin, size_t end) = 0;
+
+    /// Stores each result retained by calculateResult into the row it was calculated for.
+    virtual void storeResults(const RowSet& rows) = 0;
+
+    std::set<FieldBase*> _dependencies;
+
+  private:
+    void onDirty();
+    void onClean();
+
+    void onComputed()
+    {
+      if (_stats != nullptr)
+      {
+        _stats->recalculateCount += _computingRows.size();
+        _stats->computeNanos.record(FieldStats::now() - _computeStart);
+      }
+      _computingRows.clear();
+    }
+
+    bool _isAggregate;
+    unsigned _level;
+    RowSet _dirtyRows;
+    RowSet _computingRows;
+    /// The field's stats, which FieldBase owns
+    FieldStats* _stats;
+    uint64_t _computeStart;
+  };
+
+  template<typename TValue, typename TKey>
+  class Field : public TypedFieldBase<TValue, TKey>
+  {
+  public:
+    Field(std::string name, Domain<TKey>& domain)
+      : FieldBase(name),
+        TypedFieldBase<TValue, TKey>(name, domain)
+    {}
+
+    ~Field() override = default;
+
+  private:
+    Field(const Field&) = delete;
+    Field& operator=(const Field&) = delete;
+  };
+
+  class RelationPathIndex;
+
+  class RelationFieldBase : virtual public FieldBase
+  {
+  public:
+    explicit RelationFieldBase(std::string name)
+      : FieldBase(name),
+        _pathIndexes()
+    {}
+
+    virtual std::vector<any> getKeys(any const& remoteKey) const = 0;
+
+    /// Gets the row in the remote domain that \p localRow relates to, or an invalid row.
+    virtual RowId getRemoteRow(RowId localRow) const = 0;
+
+    /// Gets the rows in the local domain that relate to \p remoteRow.
+    virtual Span<const RowId> getLocalRows(RowId remoteRow) const = 0;
+
+    virtual DomainBase& getRemoteDomain() const = 0;
+
+    /// Registers \p index, whose path includes this relation, to be kept up to date as local
+    /// rows are related to different remote rows.
+    void addPathIndex(RelationPathIndex* index) { _pathIndexes.push_back(index); }
+
+  protected:
+    /// Updates registered path indexes after \p localRow is related to a different remote row.
+    void onRemoteRowChanged(RowId localRow);
+
+  private:
+    RelationFieldBase(const RelationFieldBase&) = delete;
+    RelationFieldBase& operator=(const RelationFieldBase&) = delete;
+
+    std::vector<RelationPathIndex*> _pathIndexes;
+  };
+
+  /// The composition of a path of two or more relations, materialised so that the remote row
+  /// at the end of the path is found, and the local rows that reach a remote row are
+  /// enumerated, without following each relation in turn.
+  ///
+  /// The index registers with every relation on the path and is updated incrementally as they
+  /// change. A change to the relation at some step affects only the local rows which reach the
+  /// changed row, and those are found by walking the reverse index of each prior step.
+  class RelationPathIndex
+  {
+  public:
+    /// Creates an index over \p path, whose first relation belongs to a domain that has
+    /// assigned \p localRowCount rows.
+    RelationPathIndex(const std::vector<RelationFieldBase*>& path, size_t localRowCount)
+      : _path(path),
+        _remoteRows(),
+        _localRows(),
+        _expandRows(),
+        _expandedRows()
+    {
+      assert(_path.size() > 1);
+
+      for (RelationFieldBase* relation : _path)
+        relation->addPathIndex(this);
+
+      for (uint32_t i = 0; i < localRowCount; i++)
+        update(RowId(i));
+    }
+
+    /// Gets the row at the end of the path from \p localRow, or an invalid row if a relation
+    /// along the path is not set.
+    RowId getRemoteRow(RowId localRow) const
+    {
+      return localRow.index < _remoteRows.size() ? _remoteRows[localRow.index] : RowId();
+    }
+
+    /// Gets the local rows whose path ends at \p remoteRow, in no particular order. Each local
+    /// row appears once.
+    Span<const RowId> getLocalRows(RowId remoteRow) const
+    {
+      return _localRows.get(remoteRow);
+    }
+
+    /// Updates the index after \p row, a local row of \p relation, is related to a different
+    /// remote row.
+    void onRelationChanged(const RelationFieldBase& relation, RowId row)
+    {
+      size_t step = std::find(_path.begin(), _path.end(), &relation) - _path.begin();
+      assert(step != _path.size());
+
+      // Find the local rows which reach the changed row, by walking back to the start
+      _expandRows.assign(1, row);
+      for (size_t i = step; i-- != 0; )
+      {
+        _expandedRows.clear();
+        for (RowId expandRow : _expandRows)
+        {
+          auto localRows = _path[i]->getLocalRows(expandRow);
+          _expandedRows.insert(_expandedRows.end(), localRows.begin(), localRows.end());
+        }
+        _expandRows.swap(_expandedRows);
+      }
+
+      for (RowId localRow : _expandRows)
+        update(localRow);
+    }
+
+    /// Recreates the index from scratch, for a domain that has assigned \p localRowCount rows.
+    void rebuild(size_t localRowCount)
+    {
+      _remoteRows.clear();
+      _localRows.clear();
+      for (uint32_t i = 0; i < localRowCount; i++)
+        update(RowId(i));
+    }
+
+  private:
+    RelationPathIndex(const RelationPathIndex&) = delete;
+    RelationPathIndex& operator=(const RelationPathIndex&) = delete;
+
+    /// Follows the path from \p localRow and records where it ends.
+    void update(RowId localRow)
+    {
+      RowId remoteRow = localRow;
+      for (RelationFieldBase* relation : _path)
+      {
+        remoteRow = relation->getRemoteRow(remoteRow);
+        if (!remoteRow.isValid())
+          break;
+      }
+
+      if (localRow.index >= _remoteRows.size())
+        _remoteRows.resize(localRow.index + 1);
+
+      RowId priorRemoteRow = _remoteRows[localRow.index];
+      if (priorRemoteRow == remoteRow)
+        return;
+      if (priorRemoteRow.isValid())
+        _localRows.erase(priorRemoteRow, localRow);
+      if (remoteRow.isValid())
+        _localRows.insert(remoteRow, localRow);
+      _remoteRows[localRow.index] = remoteRow;
+    }
+
+    const std::vector<RelationFieldBase*>& _path;
+    std::vector<RowId> _remoteRows;
+    RelationIndex _localRows;
+    std::vector<RowId> _expandRows;
+    std::vector<RowId> _expandedRows;
+  };
+
+  inline void RelationFieldBase::onRemoteRowChanged(RowId localRow)
+  {
+    for (RelationPathIndex* index : _pathIndexes)
+      index->onRelationChanged(*this, localRow);
+  }
+
+  template<typename TKeyLocal, typename TKeyRemote>
+  class RelationField : public RelationFieldBase, public TypedFieldBase<TKeyRemote, TKeyLocal>
+  {
+  public:
+    RelationField(std::string name, Domain<TKeyLocal>& localDomain, Domain<TKeyRemote>& remoteDomain)
+      : FieldBase(name),
+        RelationFieldBase(name),
+        TypedFieldBase<TKeyRemote, TKeyLocal>(name, localDomain),
+        _remoteDomain(remoteDomain),
+        _remoteRows(),
+        _localRows()
+    {}
+
+    std::vector<any> getKeys(any const& remoteKey) const override
+    {
+      assert(!remoteKey.empty());
+      assert(remoteKey.is<TKeyRemote>());
+
+      std::vector<any> keys;
+      auto& localDomain = static_cast<Domain<TKeyLocal>&>(this->getDomain());
+      for (RowId localRow : getLocalRows(_remoteDomain.findRow(any_cast<TKeyRemote>(remoteKey))))
+        keys.emplace_back(localDomain.getKey(localRow));
+      return keys;
+    }
+
+    RowId getRemoteRow(RowId localRow) const override
+    {
+      return localRow.index < _remoteRows.size() ? _remoteRows[localRow.index] : RowId();
+    }
+
+    Span<const RowId> getLocalRows(RowId remoteRow) const override
+    {
+      return _localRows.get(remoteRow);
+    }
+
+    DomainBase& getRemoteDomain() const override
+    {
+      return _remoteDomain;
+    }
+
+    /** Relates \p localRow to \p remoteRow, which must already exist in the remote domain. */
+    void setRemoteRow(RowId localRow, RowId remoteRow)
+    {
+      this->setValue(localRow, _remoteDomain.getKey(remoteRow));
+    }
+
+    void writeCheckpoint(CheckpointWriter& writer) const override
+    {
+      TypedFieldBase<TKeyRemote, TKeyLocal>::writeCheckpoint(writer);
+      writer.write<uint64_t>(_remoteRows.size());
+      writer.writeArray(_remoteRows.data(), _remoteRows.size());
+      _localRows.writeCheckpoint(writer);
+    }
+
+    /// Reads the relation's values along with both of its indexes. Path indexes that include
+    /// the relation must be rebuilt afterwards (see DomainBase::rebuildRelationPathIndexes).
+    void readCheckpoint(CheckpointReader& reader) override
+    {
+      TypedFieldBase<TKeyRemote, TKeyLocal>::readCheckpoint(reader);
+      size_t count = reader.read<uint64_t>();
+      const RowId* remoteRows = reader.readArray<RowId>(count);
+      _remoteRows.assign(remoteRows, remoteRows + count);
+      _localRows.readCheckpoint(reader);
+    }
+
+  protected:
+    void storeValue(RowId localRow, TKeyRemote const& value) override
+    {
+      // Dependants are notified after the value is stored, and resolve related rows via this
+      // index, so it is updated here
+      RowId remoteRow = _remoteDomain.getOrAddRow(value);
+      if (localRow.index >= _remoteRows.size())
+        _remoteRows.resize(localRow.index + 1);
+      RowId priorRemoteRow = _remoteRows[localRow.index];
+      if (priorRemoteRow != remoteRow)
+      {
+        // The local row no longer relates to its prior remote row, if any
+        if (priorRemoteRow.isValid())
+          _localRows.erase(priorRemoteRow, localRow);
+        _localRows.insert(remoteRow, localRow);
+        _remoteRows[localRow.index] = remoteRow;
+        this->onRemoteRowChanged(localRow);
+      }
+
+      TypedFieldBase<TKeyRemote, TKeyLocal>::storeValue(localRow, value);
+    }
+
+  private:
+    Domain<TKeyRemote>& _remoteDomain;
+    std::vector<RowId> _remoteRows;
+    RelationIndex _localRows;
+  };
+
+  class DomainBase
+  {
+  public:
+    explicit DomainBase(std::string name)
+      : _computeTasks(),
+        _publishTasks(),
+        _name(name),
+        _isInstrumented(false)
+    {}
+
+    virtual ~DomainBase() = default;
+
+    virtual bool isComputeRequired() const = 0;
+    virtual bool isPublishRequired() const = 0;
+    virtual void compute() = 0;
+    virtual void publish() = 0;
+
+    /// Appends the fields with changes awaiting publication to \p fields, and forgets them, so
+    /// that they may be published elsewhere.
+    virtual void takePublishFields(std::vector<FieldBase*>& fields) = 0;
+
+    /// Gets a vector containing a sequence of foreign keys that may be followed in order
+    /// to traverse from this domain to a related domain. If the vector is empty, then no
+    /// such path exists.
+    virtual const std::vector<RelationFieldBase*>& getRelationPathTo(const DomainBase& relatedDomain) = 0;
+    /// Gets the materialised index of the relation path to \p relatedDomain, which must be two
+    /// or more relations long. The index is created on first use.
+    virtual const RelationPathIndex& getRelationPathIndex(const DomainBase& relatedDomain) = 0;
+    virtual any getRelatedKey(any key, const DomainBase& relatedDomain) = 0;
+    /// Registers a computed field of this domain as having rows awaiting calculation.
+    virtual void addDirtyField(ComputedFieldBase* computedField) = 0;
+    /// Registers a computed field of this domain as no longer having rows awaiting calculation.
+    virtual void removeDirtyField(ComputedFieldBase* computedField) = 0;
+    /// Gets the computed fields of this domain, ordered by level.
+    virtual const std::vector<ComputedFieldBase*>& getComputedFields() const = 0;
+    virtual const std::vector<std::unique_ptr<FieldBase>>& getFields() const = 0;
+    virtual const std::vector<RelationFieldBase*> getForeignKeys() const = 0;
+
+    /// Gets the number of rows (distinct keys) this domain has assigned.
+    virtual size_t getRowCount() const = 0;
+    virtual any getBoxedKey(RowId row) const = 0;
+    virtual RowId findBoxedRow(const any& key) const = 0;
+
+    /// Copies this domain's keys for a GraphSnapshot, sharing whatever is unchanged with
+    /// \p previous, the copy made for the snapshot before.
+    virtual std::shared_ptr<const void> snapshotKeys(const std::shared_ptr<const void>& previous) const = 0;
+
+    /// Gets whether this domain's keys may be written to a checkpoint or journal.
+    virtual bool isBinaryCodable() const = 0;
+
+    /// Writes this domain's keys to a checkpoint, in a section named for the domain.
+    virtual void writeCheckpoint(CheckpointWriter& writer) const = 0;
+
+    /// Reads this domain's keys from a checkpoint. The domain must not yet have assigned any rows.
+    virtual void readCheckpoint(CheckpointReader& reader) = 0;
+
+    /// Recreates the materialised relation paths from this domain, after their relations are
+    /// read from a checkpoint.
+    virtual void rebuildRelationPathIndexes() = 0;
+
+    std::string getName() const { return _name; }
+
+    /// Adds \p task, any callable taking no arguments, to run at the start of the next compute.
+    /// Tasks are stored in an arena that is reused each cycle, so adding one does not allocate.
+    template<typename TTask>
+    void addComputeTask(TTask&& task)
+    {
+      _computeTasks.push(std::forward<TTask>(task));
+    }
+
+    /// Adds \p task, any callable taking no arguments, to run at the end of the next publish.
+    template<typename TTask>
+    void addPublishTask(TTask&& task)
+    {
+      _publishTasks.push(std::forward<TTask>(task));
+    }
+
+    /// Runs tasks added via addComputeTask, including any they add.
+    void runComputeTasks()
+    {
+      _computeTasks.run();
+    }
+
+    /// Runs tasks added via addPublishTask, including any they add.
+    void runPublishTasks()
+    {
+      _publishTasks.run();
+    }
+
+    /// Follows the relation path to \p relatedDomain from \p row, returning the related
+    /// row, or an invalid row if no path exists or a relation along it is not yet set.
+    RowId getRelatedRow(RowId row, const DomainBase& relatedDomain)
+    {
+      auto const& fks = getRelationPathTo(relatedDomain);
+
+      if (fks.empty())
+        return RowId();
+
+      for (auto fk : fks)
+      {
+        row = fk->getRemoteRow(row);
+        if (!row.isValid())
+          break;
+      }
+
+      return row;
+    }
+
+    FieldBase* findField(std::string fieldName) const
+    {
+      // TODO this could be O(1) instead of O(N) if we want to manage another map
+      for (auto const& field : getFields())
+        if (field->getName() == fieldName)
+          return field.get();
+      return nullptr;
+    }
+
+    /// Starts or stops collecting FieldStats for the fields of this domain, including those
+    /// created later. Stopping discards the stats collected.
+    void setInstrumented(bool isInstrumented)
+    {
+      _isInstrumented = isInstrumented;
+      for (auto const& field : getFields())
+        field->setInstrumented(isInstrumented);
+    }
+
+    bool isInstrumented() const { return _isInstrumented; }
+
+    /// Zeroes the stats of the fields of this domain.
+    void resetStats()
+    {
+      for (auto const& field : getFields())
+        if (FieldStats* stats = field->getStats())
+          stats->reset();
+    }
+
+  protected:
+    TaskQueue _computeTasks;
+    TaskQueue _publishTasks;
+
+  private:
+    std::string _name;
+    bool _isInstrumented;
+  };
+
+  inline void ComputedFieldBase::onDirty()
+  {
+    getDomain().addDirtyField(this);
+  }
+
+  inline void ComputedFieldBase::onClean()
+  {
+    getDomain().removeDirtyField(this);
+  }
+
+  /// Finds the row of a dependency which relates to a row of a computed field. The relation,
+  /// or materialised relation path, leading to the dependency's domain is found once, so that
+  /// resolving a row is a single indexed load. Path indexes are kept up to date as relations
+  /// change, so resolved rows never go stale.
+  class DependencyResolver
+  {
+  public:
+    DependencyResolver()
+      : _relation(nullptr),
+        _pathIndex(nullptr)
+    {}
+
+    /// Creates a resolver from rows of \p domain to rows of \p dependencyDomain, which must
+    /// either be the same domain or be related to it.
+    DependencyResolver(DomainBase& domain, const DomainBase& dependencyDomain)
+      : _relation(nullptr),
+        _pathIndex(nullptr)
+    {
+      if (&domain == &dependencyDomain)
+        return;
+      auto const& path = domain.getRelationPathTo(dependencyDomain);
+      assert(!path.empty());
+      if (path.size() == 1)
+        _relation = path[0];
+      else
+        _pathIndex = &domain.getRelationPathIndex(dependencyDomain);
+    }
+
+    /// Gets the row of the dependency's domain which relates to \p row, or an invalid row.
+    RowId resolve(RowId row) const
+    {
+      if (_relation != nullptr)
+        return _relation->getRemoteRow(row);
+      if (_pathIndex != nullptr)
+        return _pathIndex->getRemoteRow(row);
+      return row;
+    }
+
+  private:
+    const RelationFieldBase* _relation;
+    const RelationPathIndex* _pathIndex;
+  };
+
+  /// Base of all computed fields, whatever the form of their calculation.
+  template<typename TValue, typename TKey>
+  class ComputedField
+    : public ComputedFieldBase,
+      public TypedFieldBase<TValue, TKey>
+  {
+  public:
+    ~ComputedField() override = default;
+
+    DomainBase& getDomain() const override
+    {
+      return TypedFieldBase<TValue, TKey>::getDomain();
+    }
+
+    void setInstrumented(bool isInstrumented) override
+    {
+      FieldBase::setInstrumented(isInstrumented);
+      ComputedFieldBase::setStats(FieldBase::getStats());
+    }
+
+  protected:
+    ComputedField(
+      std::string name,
+      Domain<TKey>& domain,
+      std::set<FieldBase*> dependencies,
+      bool isAggregate = false)
+      : FieldBase(name),
+        ComputedFieldBase(dependencies, isAggregate),
+        TypedFieldBase<TValue, TKey>(name, domain),
+        _results(),
+        _resultCapacity(0),
+        _hasResult()
+      {}
+
+    /// Calculates the value for \p row into \p value, returning false if any dependency of
+    /// \p row cannot be resolved or holds no value. Must not modify the graph, as rows may be
+    /// calculated concurrently.
+    virtual bool tryCalculate(RowId row, TValue& value) const = 0;
+
+    void prepareResults(size_t count) override
+    {
+      if (count > _resultCapacity)
+      {
+        _results = std::make_unique<TValue[]>(count);
+        _resultCapacity = count;
+      }
+      // Bytes rather than std::vector<bool>, so that neighbouring flags may be set concurrently
+      _hasResult.assign(count, 0);
+    }
+
+    void calculateResults(const RowSet& rows, size_t begin, size_t end) override
+    {
+      for (size_t i = begin; i < end; i++)
+        _hasResult[i] = tryCalculate(rows[i], _results[i]) ? 1 : 0;
+    }
+
+    void storeResults(const RowSet& rows) override
+    {
+      for (size_t i = 0; i < rows.size(); i++)
+      {
+        if (_hasResult[i])
+          this->setValueDeferred(rows[i], _results[i]);
+      }
+      this->propagateDeferred();
+    }
+
+    /// The value calculated for each numbered row, valid where _hasResult is non-zero.
+    std::unique_ptr<TValue[]> _results;
+    size_t _resultCapacity;
+    std::vector<uint8_t> _hasResult;
+
+  private:
+    ComputedField(const ComputedField&) = delete;
+    ComputedField& operator=(const ComputedField&) = delete;
+  };
+
+  /// A computed field whose calculation receives its inputs, boxed, via Params. Dependencies
+  /// may be given at runtime, in any number and of any type.
+  template<typename TValue, typename TKey>
+  class ParamsComputedField : public ComputedField<TValue, TKey>
+  {
+  public:
+    ParamsComputedField(
+      std::string name,
+      Domain<TKey>& domain,
+      std::set<FieldBase*> dependencies,
+      std::function<TValue(const Params&)> calculation)
+      : FieldBase(name),
+        ComputedField<TValue, TKey>(name, domain, dependencies),
+        _resolvers(),
+        _calculation(calculation)
+      {
+        for (FieldBase* dependency : _dependencies)
+          _resolvers.emplace_back(dependency, DependencyResolver(domain, dependency->getDomain()));
+      }
+
+    ~ParamsComputedField() override = default;
+
+    using ComputedField<TValue, TKey>::getDomain;
+
+  protected:
+    bool canCalculate(RowId row) const override
+    {
+      for (auto const& resolver : _resolvers)
+      {
+        RowId dependencyRow = resolver.second.resolve(row);
+        if (!dependencyRow.isValid() || !resolver.first->hasValue(dependencyRow))
+          return false;
+      }
+      return true;
+    }
+
+    bool tryCalculate(RowId row, TValue& value) const override
+    {
+//      std::cout << "  recalculate " << getDomain().getName() << "::" << this->getName() << " (computed)" << std::endl;
+
+      std::map<FieldBase const*, any> valueByField;
+
+      for (auto const& resolver : _resolvers)
+      {
+        FieldBase* dependency = resolver.first;
+        RowId dependencyRow = resolver.second.resolve(row);
+        if (!dependencyRow.isValid() || !dependency->hasValue(dependencyRow))
+          return false;
+
+        auto insertResult = valueByField.insert(std::make_pair(dependency, dependency->getBoxedValue(dependencyRow)));
+        assert(insertResult.second); // value should not have previously existed
+      }
+
+      std::map<DomainBase const*, any> keyByDomain {{&getDomain(), getDomain().getBoxedKey(row)}};
+
+      Params params(std::move(keyByDomain), std::move(valueByField));
+      value = _calculation(params);
+      return true;
+    }
+
+  private:
+    ParamsComputedField(const ParamsComputedField&) = delete;
+    ParamsComputedField& operator=(const ParamsComputedField&) = delete;
+
+    using ComputedFieldBase::_dependencies;
+
+    std::vector<std::pair<FieldBase*,DependencyResolver>> _resolvers;
+    std::function<TValue(const Params&)> _calculation;
+  };
+
+  /// Base of computed fields whose dependencies are known at compile time. Resolves the row of
+  /// each dependency without boxing, leaving the form of the calculation to subclasses.
+  template<typename TValue, typename TKey, typename... TFields>
+  class TypedComputedFieldBase : public ComputedField<TValue, TKey>
+  {
+  public:
+    ~TypedComputedFieldBase() override = default;
+
+    using ComputedField<TValue, TKey>::getDomain;
+
+  protected:
+    TypedComputedFieldBase(
+      std::string name,
+      Domain<TKey>& domain,
+      TFields&... fields)
+      : FieldBase(name),
+        ComputedField<TValue, TKey>(name, domain, {&fields...}),
+        _fields(&fields...),
+        _resolvers{{DependencyResolver(domain, fields.getDomain())...}}
+      {}
+
+    typedef std::index_sequence_for<TFields...> Indices;
+    typedef std::array<RowId, sizeof...(TFields)> Rows;
+
+    bool canCalculate(RowId row) const override
+    {
+      Rows rows;
+      return resolve(row, rows, Indices());
+    }
+
+    /// Finds the row of each dependency which relates to \p row, returning false if any
+    /// cannot be found or holds no value.
+    template<size_t... I>
+    bool resolve(RowId row, Rows& rows, std::index_sequence<I...>) const
+    {
+      bool resolved = true;
+      (void)std::initializer_list<int>{(resolved = resolved && resolveOne<I>(row, rows[I]), 0)...};
+      return resolved;
+    }
+
+    std::tuple<const TypedFieldBase<typename TFields::ValueType, typename TFields::KeyType>*...> _fields;
+
+  private:
+    TypedComputedFieldBase(const TypedComputedFieldBase&) = delete;
+    TypedComputedFieldBase& operator=(const TypedComputedFieldBase&) = delete;
+
+    template<size_t I>
+    bool resolveOne(RowId row, RowId& dependencyRow) const
+    {
+      dependencyRow = _resolvers[I].resolve(row);
+      return dependencyRow.isValid() && std::get<I>(_fields)->hasValue(dependencyRow);
+    }
+
+    std::array<DependencyResolver, sizeof...(TFields)> _resolvers;
+  };
+
+  /// A computed field whose dependencies are known at compile time. The calculation receives
+  /// each dependency's value, by reference into its column, as a typed argument, in the order
+  /// the dependencies were given. Nothing is boxed and nothing is allocated per recalculation.
+  template<typename TValue, typename TKey, typename TCalculation, typename... TFields>
+  class TypedComputedField : public TypedComputedFieldBase<TValue, TKey, TFields...>
+  {
+  public:
+    TypedComputedField(
+      std::string name,
+      Domain<TKey>& domain,
+      TCalculation calculation,
+      TFields&... fields)
+      : FieldBase(name),
+        TypedComputedFieldBase<TValue, TKey, TFields...>(name, domain, fields...),
+        _calculation(std::move(calculation))
+      {}
+
+    ~TypedComputedField() override = default;
+
+  protected:
+    typedef TypedComputedFieldBase<TValue, TKey, TFields...> Base;
+
+    bool tryCalculate(RowId row, TValue& value) const override
+    {
+      typename Base::Rows rows;
+      if (!this->resolve(row, rows, typename Base::Indices()))
+        return false;
+      value = invoke(rows, typename Base::Indices());
+      return true;
+    }
+
+  private:
+    TypedComputedField(const TypedComputedField&) = delete;
+    TypedComputedField& operator=(const TypedComputedField&) = delete;
+
+    template<size_t... I>
+    TValue invoke(const typename Base::Rows& rows, std::index_sequence<I...>) const
+    {
+      return _calculation(std::get<I>(this->_fields)->getValue(rows[I])...);
+    }
+
+    TCalculation _calculation;
+  };
+
+  /// A computed field whose kernel calculates many rows per call. Dependency values for a
+  /// batch of dirty rows are gathered, through relations where needed, into contiguous
+  /// buffers, and the kernel receives them as spans alongside a span for its output:
+  ///
+  ///     void kernel(Span<TValue> out, Span<const TValue1> in1, ..., Span<const TValueN> inN)
+  ///
+  /// Element i of every span relates to the same row. Kernels are free to loop in whatever
+  /// way suits the compiler's vectoriser, or to use SIMD intrinsics directly.
+  template<typename TValue, typename TKey, typename TKernel, typename... TFields>
+  class BatchComputedField : public TypedComputedFieldBase<TValue, TKey, TFields...>
+  {
+  public:
+    /// The maximum number of rows passed to a single call of the kernel. Buffers of this size
+    /// live on the stack, so batches may be calculated concurrently without allocating.
+    static const size_t BatchSize = 256;
+
+    BatchComputedField(
+      std::string name,
+      Domain<TKey>& domain,
+      TKernel kernel,
+      TFields&... fields)
+      : FieldBase(name),
+        TypedComputedFieldBase<TValue, TKey, TFields...>(name, domain, fields...),
+        _kernel(std::move(kernel))
+      {}
+
+    ~BatchComputedField() override = default;
+
+  protected:
+    typedef TypedComputedFieldBase<TValue, TKey, TFields...> Base;
+
+    bool tryCalculate(RowId row, TValue& value) const override
+    {
+      Batch batch;
+      typename Base::Rows rows;
+      if (!this->resolve(row, rows, typename Base::Indices()))
+        return false;
+      gather(batch, 0, rows, typename Base::Indices());
+      invoke(batch, &value, 1, typename Base::Indices());
+      return true;
+    }
+
+    void calculateResults(const RowSet& rows, size_t begin, size_t end) override
+    {
+      Batch batch;
+      std::array<size_t, BatchSize> numbers;
+      size_t count = 0;
+
+      for (size_t i = begin; i < end; i++)
+      {
+        typename Base::Rows dependencyRows;
+        this->_hasResult[i] = this->resolve(rows[i], dependencyRows, typename Base::Indices()) ? 1 : 0;
+        if (!this->_hasResult[i])
+          continue;
+
+        gather(batch, count, dependencyRows, typename Base::Indices());
+        numbers[count++] = i;
+
+        if (count == BatchSize)
+        {
+          calculateBatch(batch, numbers, count);
+          count = 0;
+        }
+      }
+
+      if (count != 0)
+        calculateBatch(batch, numbers, count);
+    }
+
+  private:
+    BatchComputedField(const BatchComputedField&) = delete;
+    BatchComputedField& operator=(const BatchComputedField&) = delete;
+
+    struct Batch
+    {
+      std::tuple<std::array<typename TFields::ValueType, BatchSize>...> inputs;
+      std::array<TValue, BatchSize> output;
+    };
+
+    template<size_t... I>
+    void gather(Batch& batch, size_t index, const typename Base::Rows& rows, std::index_sequence<I...>) const
+    {
+      (void)std::initializer_list<int>{(std::get<I>(batch.inputs)[index] = std::get<I>(this->_fields)->getValue(rows[I]), 0)...};
+    }
+
+    template<size_t... I>
+    void invoke(const Batch& batch, TValue* output, size_t count, std::index_sequence<I...>) const
+    {
+      _kernel(
+        Span<TValue>(output, count),
+        Span<const typename TFields::ValueType>(std::get<I>(batch.inputs).data(), count)...);
+    }
+
+    /// Runs the kernel over the first \p count gathered rows, scattering its output to the
+    /// result for each row's number.
+    void calculateBatch(Batch& batch, const std::array<size_t, BatchSize>& numbers, size_t count)
+    {
+      invoke(batch, batch.output.data(), count, typename Base::Indices());
+      for (size_t j = 0; j < count; j++)
+        this->_results[numbers[j]] = std::move(batch.output[j]);
+    }
+
+    TKernel _kernel;
+  };
+
+  /// A computed field holding state per row, such as a window of recent inputs, which is
+  /// updated as the row's inputs change rather than calculated afresh. Each row has its own
+  /// copy of an accumulator, which must provide:
+  ///
+  ///     void add(const TValue1& in1, ..., const TValueN& inN)
+  ///     TValue get() const
+  ///
+  /// A row takes a sample of its dependencies' values for each change to them, and the field
+  /// takes the accumulator's result when next computed. Changes to several dependencies of a
+  /// row are gathered into one sample until one of them changes again, or the field is
+  /// computed, so that setting the price and quantity of a trade is a single sample, whereas
+  /// every price set between computes is a sample of its own. Changes to the relations used
+  /// to reach dependencies are not samples, and a row has no value until its first sample.
+  ///
+  /// Rows whose values are set in bulk or via Graph::enqueue receive one change per batch.
+  ///
+  /// Accumulators are written to checkpoints, so a restored field continues its windows. An
+  /// accumulator that is not trivially copyable must specialise BinaryCodec for this, as the
+  /// accumulators of window.hh do, or the graph cannot be checkpointed.
+  template<typename TValue, typename TKey, typename TAccumulator, typename... TFields>
+  class AccumulatedComputedField : public TypedComputedFieldBase<TValue, TKey, TFields...>
+  {
+  public:
+    AccumulatedComputedField(
+      std::string name,
+      Domain<TKey>& domain,
+      TAccumulator accumulator,
+      TFields&... fields)
+      : FieldBase(name),
+        TypedComputedFieldBase<TValue, TKey, TFields...>(name, domain, fields...),
+        _prototype(std::move(accumulator)),
+        _rows()
+      {}
+
+    ~AccumulatedComputedField() override = default;
+
+    /// Gets the accumulator of \p row, or null if the row has taken no sample yet.
+    const TAccumulator* getAccumulator(RowId row) const
+    {
+      if (!row.isValid() || row.index >= _rows.size() || !_rows[row.index].hasSamples)
+        return nullptr;
+      return &_rows[row.index].accumulator;
+    }
+
+    bool onInputChanged(const FieldBase& input, RowId row) override
+    {
+      int index = indexOf(input, typename Base::Indices());
+      if (index == -1)
+        return this->recalculate(row);
+
+      if (row.index >= _rows.size())
+        _rows.resize(this->getDomain().getRowCount(), RowState(_prototype));
+      RowState& state = _rows[row.index];
+
+      // A dependency changing again begins a new sample, so the one gathered so far is taken
+      if (state.changed.test(index) && state.isSamplePending)
+        takeSample(state);
+      state.changed.set(index);
+
+      if (!this->recalculate(row))
+        return false;
+      typename Base::Rows rows;
+      this->resolve(row, rows, typename Base::Indices());
+      gather(state.sample, rows, typename Base::Indices());
+      state.isSamplePending = true;
+      return true;
+    }
+
+    bool isBinaryCodable() const override
+    {
+      return Base::isBinaryCodable() && IsBinaryCodable<TAccumulator>::value;
+    }
+
+    void writeCheckpoint(CheckpointWriter& writer) const override
+    {
+      Base::writeCheckpoint(writer);
+      writer.write<uint64_t>(_rows.size());
+      for (auto const& state : _rows)
+      {
+        // A checkpoint is only written once computed, so no row has a sample pending
+        assert(!state.isSamplePending);
+        writer.write<uint8_t>(state.hasSamples ? 1 : 0);
+        if (state.hasSamples)
+          BinaryCodec<TAccumulator>::write(writer, state.accumulator);
+      }
+    }
+
+    void readCheckpoint(CheckpointReader& reader) override
+    {
+      Base::readCheckpoint(reader);
+      _rows.assign(reader.read<uint64_t>(), RowState(_prototype));
+      for (auto& state : _rows)
+      {
+        state.hasSamples = reader.read<uint8_t>() != 0;
+        if (state.hasSamples)
+          state.accumulator = BinaryCodec<TAccumulator>::read(reader);
+      }
+    }
+
+  protected:
+    typedef TypedComputedFieldBase<TValue, TKey, TFields...> Base;
+
+    bool tryCalculate(RowId row, TValue& value) const override
+    {
+      if (row.index >= _rows.size())
+        return false;
+      RowState& state = _rows[row.index];
+      if (state.isSamplePending)
+        takeSample(state);
+      if (!state.hasSamples)
+        return false;
+      value = state.accumulator.get();
+      return true;
+    }
+
+  private:
+    AccumulatedComputedField(const AccumulatedComputedField&) = delete;
+    AccumulatedComputedField& operator=(const AccumulatedComputedField&) = delete;
+
+    typedef std::tuple<typename TFields::ValueType...> Sample;
+
+    struct RowState
+    {
+      explicit RowState(const TAccumulator& prototype)
+        : accumulator(prototype),
+          sample(),
+          changed(),
+          isSamplePending(false),
+          hasSamples(false)
+      {}
+
+      TAccumulator accumulator;
+      /// The values gathered for the next sample
+      Sample sample;
+      /// The dependencies changed since the last sample was taken
+      std::bitset<sizeof...(TFields)> changed;
+      bool isSamplePending;
+      bool hasSamples;
+    };
+
+    /// Gets the position of \p input amongst this field's dependencies, or -1 if it is not one,
+    /// such as a relation used to reach them.
+    template<size_t... I>
+    int indexOf(const FieldBase& input, std::index_sequence<I...>) const
+    {
+      int index = -1;
+      (void)std::initializer_list<int>{(index = index == -1 && static_cast<const FieldBase*>(std::get<I>(this->_fields)) == &input ? int(I) : index, 0)...};
+      return index;
+    }
+
+    template<size_t... I>
+    void gather(Sample& sample, const typename Base::Rows& rows, std::index_sequence<I...>) const
+    {
+      (void)std::initializer_list<int>{(std::get<I>(sample) = std::get<I>(this->_fields)->getValue(rows[I]), 0)...};
+    }
+
+    void takeSample(RowState& state) const
+    {
+      add(state.accumulator, state.sample, typename Base::Indices());
+      state.isSamplePending = false;
+      state.hasSamples = true;
+      state.changed.reset();
+    }
+
+    template<size_t... I>
+    static void add(TAccumulator& accumulator, const Sample& sample, std::index_sequence<I...>)
+    {
+      accumulator.add(std::get<I>(sample)...);
+    }
+
+    TAccumulator _prototype;
+    /// The state of each row, by index. Only the state of a row being calculated is modified,
+    /// so calculation remains safe across threads.
+    mutable std::vector<RowState> _rows;
+  };
+
+  /// A computed field whose rows each aggregate the values of a field of another domain,
+  /// across the rows which relate to them. For example, the total return of each instrument,
+  /// summed across the trades of that instrument.
+  ///
+  /// Aggregates are maintained by deltas rather than recalculated: each row of the aggregated
+  /// domain remembers the value it contributed and the row it contributed it to, so that when
+  /// its value changes or it relates to another row, the old contribution is removed and the
+  /// new one added. Each change therefore costs the same, however many rows relate to the same
+  /// row. See aggregate.hh for aggregators.
+  ///
+  /// Where an aggregator may give no result, as for the minimum of no values, the field's
+  /// values are std::optional, and a row to which no rows relate any more is given an empty
+  /// value.
+  template<typename TValue, typename TKey, typename TChildValue, typename TChildKey, typename TAggregator>
+  class AggregateField : public ComputedField<TValue, TKey>
+  {
+    static_assert(AggregatorAlwaysHasResult<TAggregator>::value || IsOptional<TValue>::value,
+      "Aggregators that may give no result, such as Min, require std::optional values");
+
+  public:
+    AggregateField(
+      std::string name,
+      Domain<TKey>& domain,
+      TAggregator aggregator,
+      TypedFieldBase<TChildValue, TChildKey>& childField,
+      RelationField<TChildKey, TKey>& relation)
+      : FieldBase(name),
+        ComputedField<TValue, TKey>(name, domain, {&childField, &relation}, true),
+        _childField(childField),
+        _relation(relation),
+        _prototype(std::move(aggregator)),
+        _aggregators(),
+        _contributions(),
+        _isStale(true)
+      {}
+
+    ~AggregateField() override = default;
+
+    void aggregateRows(Span<const RowId> rows) override
+    {
+      // Contributions are discarded when read from a checkpoint
+      if (_isStale)
+        aggregateAll();
+
+      for (RowId row : rows)
+        aggregateRow(row);
+    }
+
+    /// Builds the contribution of every row of the aggregated domain, marking each row they
+    /// contribute to for calculation. Called once the field is created, so that values set
+    /// before it existed are aggregated.
+    void aggregateAll()
+    {
+      _isStale = false;
+      uint32_t childRowCount = static_cast<uint32_t>(_childField.getDomain().getRowCount());
+      for (uint32_t index = 0; index < childRowCount; index++)
+        aggregateRow(RowId(index));
+    }
+
+    void readCheckpoint(CheckpointReader& reader) override
+    {
+      ComputedField<TValue, TKey>::readCheckpoint(reader);
+      _aggregators.clear();
+      _contributions.clear();
+      _isStale = true;
+    }
+
+  protected:
+    bool canCalculate(RowId row) const override
+    {
+      return row.index < _aggregators.size();
+    }
+
+    bool tryCalculate(RowId row, TValue& value) const override
+    {
+      return getResult(_aggregators[row.index], value);
+    }
+
+  private:
+    AggregateField(const AggregateField&) = delete;
+    AggregateField& operator=(const AggregateField&) = delete;
+
+    template<typename T>
+    static bool getResult(const TAggregator& aggregator, T& value)
+    {
+      return aggregator.tryGet(value);
+    }
 
-        //
-        // Find dependency's value
-        //
+    /// Gives an empty value where the aggregator has no result.
+    template<typename T>
+    static bool getResult(const TAggregator& aggregator, std::optional<T>& value)
+    {
+      T result;
+      if (aggregator.tryGet(result))
+        value = std::move(result);
+      else
+        value.reset();
+      return true;
+    }
 
-        any dependencyValue = dependency->getValue(dependencyKey);
-        if (dependencyValue.empty())
-        {
-//          std::cout << "      dependencyValue not found for " << dependency->getName() << std::endl;
-          return false;
-        }
-//        else
-//        {
-//          std::cout << "      dependencyValue found: " << dependencyValue << std::endl;
-//        }
-
-        //
-        // Store the dependency's value
-        //
-        auto insertResult = valueByField.insert(std::make_pair(dependency, dependencyValue));
-        assert(insertResult.second); // value should not have previously existed
+    struct Contribution
+    {
+      /// The row contributed to, or an invalid row if none
+      RowId row;
+      TChildValue value;
+    };
+
+    /// Moves the contribution of \p childRow to reflect its current value and relation.
+    void aggregateRow(RowId childRow)
+    {
+      if (childRow.index >= _contributions.size())
+        _contributions.resize(_childField.getDomain().getRowCount());
+
+      Contribution& contribution = _contributions[childRow.index];
+      if (contribution.row.isValid())
+      {
+        _aggregators[contribution.row.index].remove(contribution.value);
+        this->recalculate(contribution.row);
       }
 
-      // TODO avoid copying these maps into the lambda -- need C++14-style move, or functor or similar
-      getDomain().addComputeTask([this, key, keyByDomain, valueByField]
+      RowId row = _relation.getRemoteRow(childRow);
+      if (!row.isValid() || !_childField.hasValue(childRow))
       {
-        Params params(keyByDomain, valueByField);
-        const TValue val = _calculation(params);
-        this->TypedFieldBase<TValue,TKey>::setValue(any_cast<TKey>(key), val);
-      });
+        contribution.row = RowId();
+        return;
+      }
 
-      return true;
-    }
+      if (row.index >= _aggregators.size())
+        _aggregators.resize(this->getDomain().getRowCount(), _prototype);
 
-    DomainBase& getDomain() const override
-    {
-      return TypedFieldBase<TValue, TKey>::getDomain();
+      contribution.row = row;
+      contribution.value = _childField.getValue(childRow);
+      _aggregators[row.index].add(contribution.value);
+      this->recalculate(row);
     }
 
-  private:
-    ComputedField(const ComputedField&) = delete;
-    ComputedField& operator=(const ComputedField&) = delete;
-
-    std::function<TValue(const Params&)> _calculation;
+    const TypedFieldBase<TChildValue, TChildKey>& _childField;
+    const RelationFieldBase& _relation;
+    TAggregator _prototype;
+    /// The aggregator of each row of this field's domain, by index
+    std::vector<TAggregator> _aggregators;
+    /// The contribution of each row of the aggregated domain, by index
+    std::vector<Contribution> _contributions;
+    /// Whether contributions must be rebuilt from every row of the aggregated domain
+    bool _isStale;
   };
 
   template<typename TKey>
@@ -462,9 +3181,8 @@ namespace flux
     template<typename TValue>
     Field<TValue,TKey>& createField(std::string name)
     {
-      auto field = std::make_unique<Field<TValue,TKey>>(name, *this);
-      auto ptr = field.get();
-      _fields.push_back(std::move(field));
+      auto ptr = new Field<TValue,TKey>(name, *this);
+      addField(ptr);
       return *ptr;
     }
 
@@ -475,27 +3193,36 @@ namespace flux
       assert(reinterpret_cast<void*>(&remoteDomain) != this);
       std::stringstream name;
       name << getName() << "->" << remoteDomain.getName();
-      auto field = std::make_unique<RelationField<TKey,TRemoteKey>>(name.str(), *this, remoteDomain);
-      auto ptr = field.get();
-      _foreignKeys[&remoteDomain] = field.get();
-      _fields.push_back(std::move(field));
+      auto ptr = new RelationField<TKey,TRemoteKey>(name.str(), *this, remoteDomain);
+      _foreignKeys[&remoteDomain] = ptr;
+      addField(ptr);
       return *ptr;
     }
 
+    /// Marks the rows of computed fields that depend upon \p rows of \p changedField for
+    /// recalculation. \p rows must not contain duplicates.
     template<typename TValue>
-    void onComputationInputChanged(TypedFieldBase<TValue,TKey>& changedField, const any& key)
+    void onComputationInputChanged(TypedFieldBase<TValue,TKey>& changedField, Span<const RowId> rows)
     {
-      assert(!key.empty() && key.is<TKey>());
       assert(&changedField.getDomain() == this);
 
-//      std::cout << "changed: " << changedField.getName() << " key=" << key << std::endl;
+      FieldStats* stats = changedField.getStats();
 
       // Recalculate all computed fields that registered themselves as dependants of the field that changed
       for (auto computedField : changedField.getDependants())
       {
-        if (&computedField->getDomain() == this)
+        if (computedField->isAggregate())
+        {
+          // The dependant aggregates rows of this domain, and finds those it must recalculate
+          computedField->aggregateRows(rows);
+        }
+        else if (&computedField->getDomain() == this)
         {
-          computedField->recalculate(key);
+          for (RowId row : rows)
+            computedField->onInputChanged(changedField, row);
+          if (stats != nullptr)
+            for (size_t i = 0; i < rows.size(); i++)
+              stats->fanOut.record(1);
         }
         else
         {
@@ -510,195 +3237,838 @@ namespace flux
           {
             // Only one step away
             RelationFieldBase* relationField = relationPath[0];
-            // There may be *many* keys in that domain to recompute.
-            auto remoteKeys = relationField->getKeys(key);
-            for (auto relatedKey : remoteKeys)
-              computedField->recalculate(relatedKey);
+            // There may be *many* rows in that domain to recompute.
+            for (RowId row : rows)
+            {
+              Span<const RowId> relatedRows = relationField->getLocalRows(row);
+              for (RowId relatedRow : relatedRows)
+                computedField->onInputChanged(changedField, relatedRow);
+              if (stats != nullptr)
+                stats->fanOut.record(relatedRows.size());
+            }
           }
           else
           {
-            // Multiple steps away
-            std::vector<any> expandKeys {key};
-            for (RelationFieldBase* relationField : relationPath)
+            // Multiple steps away. The remote domain keeps a materialised index of the whole
+            // path, giving each of its rows which reach the changed row exactly once.
+            const RelationPathIndex& pathIndex = remoteDomain.getRelationPathIndex(*this);
+            for (RowId row : rows)
             {
-              std::vector<any> allRemoteKeys;
-              for (any expandKey : expandKeys)
-              {
-                auto remoteKeys = relationField->getKeys(expandKey);
-                allRemoteKeys.insert(allRemoteKeys.end(), remoteKeys.begin(), remoteKeys.end());
-              }
-              expandKeys = allRemoteKeys;
+              Span<const RowId> relatedRows = pathIndex.getLocalRows(row);
+              for (RowId relatedRow : relatedRows)
+                computedField->onInputChanged(changedField, relatedRow);
+              if (stats != nullptr)
+                stats->fanOut.record(relatedRows.size());
             }
-            for (auto relatedKey : expandKeys)
-              computedField->recalculate(relatedKey);
           }
         }
       }
     }
 
-    /** Creates a new computed field. */
+    /** Creates a new computed field whose calculation receives its inputs via Params. */
     template<typename TValue>
     ComputedField<TValue, TKey>& compute(std::string name, std::set<FieldBase*> fields, std::function<TValue(const Params&)> calculation)
     {
-      auto ptr = new ComputedField<TValue,TKey>(name, *this, fields, calculation);
-      _fields.emplace_back(ptr);
+      auto ptr = new ParamsComputedField<TValue,TKey>(name, *this, fields, calculation);
+      addField(ptr);
+      addComputedField(ptr);
+      return *ptr;
+    }
+
+    /**
+     * Creates a new computed field whose calculation receives the values of \p fields as
+     * typed arguments, in order. For example:
+     *
+     *     trade.compute<double>("notional", std::tie(cumQty, avgPx),
+     *       [](unsigned qty, double px) { return qty * px; });
+     */
+    template<typename TValue, typename... TFields, typename TCalculation>
+    ComputedField<TValue, TKey>& compute(std::string name, std::tuple<TFields&...> fields, TCalculation calculation)
+    {
+      static_assert(sizeof...(TFields) != 0, "A computed field requires at least one dependency");
+      auto ptr = createTypedComputedField<TValue>(name, std::move(calculation), fields, std::index_sequence_for<TFields...>());
+      addField(ptr);
+      addComputedField(ptr);
+      return *ptr;
+    }
+
+    /**
+     * Creates a new computed field whose kernel calculates a batch of rows per call, receiving
+     * the values of \p fields as spans. For example:
+     *
+     *     trade.computeBatch<double>("notional", std::tie(cumQty, avgPx),
+     *       [](Span<double> out, Span<const unsigned> qty, Span<const double> px)
+     *       {
+     *         for (size_t i = 0; i < out.size(); i++)
+     *           out[i] = qty[i] * px[i];
+     *       });
+     */
+    template<typename TValue, typename... TFields, typename TKernel>
+    ComputedField<TValue, TKey>& computeBatch(std::string name, std::tuple<TFields&...> fields, TKernel kernel)
+    {
+      static_assert(sizeof...(TFields) != 0, "A computed field requires at least one dependency");
+      auto ptr = createBatchComputedField<TValue>(name, std::move(kernel), fields, std::index_sequence_for<TFields...>());
+      addField(ptr);
+      addComputedField(ptr);
+      return *ptr;
+    }
+
+    /**
+     * Creates a new computed field whose rows each keep an accumulator, a copy of
+     * \p accumulator, to which the values of \p fields are added as a sample each time they
+     * change. For example, a moving average of the last ten prices:
+     *
+     *     instrument.accumulate<double>("avgPx10", std::tie(lastPx), MovingAverage(10));
+     *
+     * See AccumulatedComputedField, and window.hh for accumulators.
+     */
+    template<typename TValue, typename... TFields, typename TAccumulator>
+    ComputedField<TValue, TKey>& accumulate(std::string name, std::tuple<TFields&...> fields, TAccumulator accumulator)
+    {
+      static_assert(sizeof...(TFields) != 0, "A computed field requires at least one dependency");
+      auto ptr = createAccumulatedComputedField<TValue>(name, std::move(accumulator), fields, std::index_sequence_for<TFields...>());
+      addField(ptr);
+      addComputedField(ptr);
+      return *ptr;
+    }
+
+    /**
+     * Creates a new computed field aggregating the values of \p childField, of a domain which
+     * relates to this one via \p relation, across the rows relating to each row of this
+     * domain, using a copy of \p aggregator per row. For example:
+     *
+     *     instrument.aggregate<double>("totalReturn", tradeReturn, tradeInstrument, Sum<double>());
+     *     instrument.aggregate<std::optional<int>>("minQty", qty, tradeInstrument, Min<int>());
+     *
+     * See AggregateField, and aggregate.hh for aggregators.
+     */
+    template<typename TValue, typename TChildValue, typename TChildKey, typename TAggregator>
+    ComputedField<TValue, TKey>& aggregate(std::string name, TypedFieldBase<TChildValue, TChildKey>& childField, RelationField<TChildKey, TKey>& relation, TAggregator aggregator)
+    {
+      assert(&childField.getDomain() == &relation.getDomain());
+      assert(&relation.getRemoteDomain() == this);
+      auto ptr = new AggregateField<TValue,TKey,TChildValue,TChildKey,TAggregator>(name, *this, std::move(aggregator), childField, relation);
+      addField(ptr);
+      addComputedField(ptr);
+      ptr->aggregateAll();
+      return *ptr;
+    }
+
+    /// Registers a field of this domain as having changes awaiting publication.
+    void addPublishField(FieldBase* field)
+    {
+      assert(&field->getDomain() == this);
+      _publishFields.push_back(field);
+    }
+
+    void addDirtyField(ComputedFieldBase* computedField) override
+    {
+      assert(&computedField->getDomain() == this);
+      _dirtyFieldCount++;
+    }
+
+    void removeDirtyField(ComputedFieldBase* computedField) override
+    {
+      assert(&computedField->getDomain() == this);
+      assert(_dirtyFieldCount != 0);
+      _dirtyFieldCount--;
+    }
+
+    const std::vector<ComputedFieldBase*>& getComputedFields() const override { return _computedFields; }
+
+    bool isComputeRequired() const override
+    {
+      return !_computeTasks.empty() || _dirtyFieldCount != 0;
+    }
+
+    bool isPublishRequired() const override
+    {
+      return !_publishTasks.empty() || !_publishFields.empty();
+    }
+
+    /// Calculates this domain's dirty computed fields in order of level.
+    ///
+    /// Computed fields of other domains are not calculated, so prefer Graph::compute when
+    /// computed fields depend upon fields of other domains.
+    void compute() override
+    {
+      // Tasks may set further inputs, so continue until nothing remains
+      while (isComputeRequired())
+      {
+        runComputeTasks();
+        for (auto computedField : _computedFields)
+          computedField->computeDirty();
+      }
+    }
+
+    void publish() override
+    {
+      _publishingFields.swap(_publishFields);
+      for (auto field : _publishingFields)
+        field->publishChanges();
+      _publishingFields.clear();
+
+      runPublishTasks();
+    }
+
+    void takePublishFields(std::vector<FieldBase*>& fields) override
+    {
+      fields.insert(fields.end(), _publishFields.begin(), _publishFields.end());
+      _publishFields.clear();
+    }
+
+    const std::vector<RelationFieldBase*> getForeignKeys() const override
+    {
+      std::vector<RelationFieldBase*> fks;
+      for (auto const& pair : _foreignKeys)
+        fks.push_back(pair.second);
+      return fks;
+    }
+
+    const RelationPathIndex& getRelationPathIndex(const DomainBase& relatedDomain) override
+    {
+      auto cached = _relationPathIndexes.find(&relatedDomain);
+      if (cached != _relationPathIndexes.end())
+        return *cached->second;
+
+      auto index = std::make_unique<RelationPathIndex>(getRelationPathTo(relatedDomain), getRowCount());
+      return *_relationPathIndexes.emplace(&relatedDomain, std::move(index)).first->second;
+    }
+
+    const std::vector<RelationFieldBase*>& getRelationPathTo(const DomainBase& relatedDomain)
+    {
+      DomainBase* relatedPtr = const_cast<DomainBase*>(&relatedDomain);
+
+      // See if we have a cached result
+      auto cached = _relationPaths.find(relatedPtr);
+      if (cached != _relationPaths.end())
+        return cached->second;
+
+      // No cached result, so create one...
+
+      // Test whether the related domain is a direct relation
+      auto direct = _foreignKeys.find(relatedPtr);
+      if (direct != _foreignKeys.end())
+      {
+        std::vector<RelationFieldBase*> keys {direct->second};
+        auto res = _relationPaths.emplace(relatedPtr, std::move(keys));
+        assert(res.second);
+        return res.first->second;
+      }
+
+      // The relationship is not direct, so search for an indirect one
+
+      auto path = findPath<DomainBase*,RelationFieldBase*>(this, relatedPtr,
+        [](DomainBase* d)
+        {
+          std::queue<std::pair<RelationFieldBase*,DomainBase*>> edges;
+          for (auto fk : d->getForeignKeys())
+            edges.emplace(fk, &fk->getRemoteDomain());
+          return edges;
+        });
+
+      // Return just a vector of the relation fields
+      std::vector<RelationFieldBase*> fkPath;
+      for (auto const& p : path)
+        fkPath.push_back(p.first);
+
+      // Memoize (move into cache)
+      auto res = _relationPaths.emplace(relatedPtr, move(fkPath));
+      assert(res.second);
+
+      // Return reference to cached version
+      return res.first->second;
+    }
+
+    const std::vector<std::unique_ptr<FieldBase>>& getFields() const override { return _fields; }
+
+    /// Returns the row assigned to \p key, or an invalid row if the key has never been seen.
+    ///
+    /// \p key may be of any type the domain's KeyHash accepts, such as \c std::string_view
+    /// for string keyed domains, in which case no temporary key is constructed.
+    template<typename TLookup>
+    RowId findRow(const TLookup& key) const
+    {
+      return _keys.find(key);
+    }
+
+    /// Returns the row assigned to \p key, assigning the next free row if the key is new.
+    template<typename TLookup>
+    RowId getOrAddRow(const TLookup& key)
+    {
+      return _keys.insert(key);
+    }
+
+    const TKey& getKey(RowId row) const
+    {
+      return _keys[row];
+    }
+
+    size_t getRowCount() const override { return _keys.size(); }
+
+    any getBoxedKey(RowId row) const override
+    {
+      return any(_keys[row]);
+    }
+
+    RowId findBoxedRow(const any& key) const override
+    {
+      assert(!key.empty() && key.is<TKey>());
+      return _keys.find(any_cast<TKey>(key));
+    }
+
+    std::shared_ptr<const void> snapshotKeys(const std::shared_ptr<const void>& previous) const override
+    {
+      return KeySnapshot<TKey>::extend(std::static_pointer_cast<const KeySnapshot<TKey>>(previous), _keys);
+    }
+
+    bool isBinaryCodable() const override
+    {
+      return IsBinaryCodable<TKey>::value;
+    }
+
+    void writeCheckpoint(CheckpointWriter& writer) const override
+    {
+      writer.beginSection(getName(), typeid(TKey).name());
+      writer.write<uint64_t>(_keys.size());
+      for (uint32_t i = 0; i < _keys.size(); i++)
+        BinaryCodec<TKey>::write(writer, _keys[RowId(i)]);
+    }
+
+    void readCheckpoint(CheckpointReader& reader) override
+    {
+      reader.expectSection(getName(), typeid(TKey).name());
+      if (_keys.size() != 0)
+        throw std::runtime_error("A checkpoint must be read into a domain without keys");
+
+      // Keys are inserted in row order, so each is assigned the row it had when written
+      size_t count = reader.read<uint64_t>();
+      for (size_t i = 0; i < count; i++)
+        _keys.insert(BinaryCodec<TKey>::read(reader));
+      if (_keys.size() != count)
+        throw std::runtime_error("Checkpoint holds duplicate keys");
+    }
+
+    void rebuildRelationPathIndexes() override
+    {
+      for (auto const& pair : _relationPathIndexes)
+        pair.second->rebuild(getRowCount());
+    }
+
+    any getRelatedKey(any key, const DomainBase& relatedDomain) override
+    {
+      assert(!key.empty());
+      assert(key.is<TKey>());
+
+      RowId row = findBoxedRow(key);
+      if (row.isValid())
+        row = getRelatedRow(row, relatedDomain);
+
+      return row.isValid() ? relatedDomain.getBoxedKey(row) : any();
+    }
+
+  private:
+    Domain(const Domain&) = delete;
+    Domain& operator=(const Domain&) = delete;
+
+    template<typename TValue, typename TCalculation, typename... TFields, size_t... I>
+    ComputedField<TValue, TKey>* createTypedComputedField(std::string name, TCalculation calculation, std::tuple<TFields&...> fields, std::index_sequence<I...>)
+    {
+      return new TypedComputedField<TValue,TKey,TCalculation,TFields...>(name, *this, std::move(calculation), std::get<I>(fields)...);
+    }
+
+    template<typename TValue, typename TKernel, typename... TFields, size_t... I>
+    ComputedField<TValue, TKey>* createBatchComputedField(std::string name, TKernel kernel, std::tuple<TFields&...> fields, std::index_sequence<I...>)
+    {
+      return new BatchComputedField<TValue,TKey,TKernel,TFields...>(name, *this, std::move(kernel), std::get<I>(fields)...);
+    }
+
+    template<typename TValue, typename TAccumulator, typename... TFields, size_t... I>
+    ComputedField<TValue, TKey>* createAccumulatedComputedField(std::string name, TAccumulator accumulator, std::tuple<TFields&...> fields, std::index_sequence<I...>)
+    {
+      return new AccumulatedComputedField<TValue,TKey,TAccumulator,TFields...>(name, *this, std::move(accumulator), std::get<I>(fields)...);
+    }
+
+    /// Takes ownership of \p field, instrumenting it if this domain is instrumented.
+    void addField(FieldBase* field)
+    {
+      _fields.emplace_back(field);
+      if (isInstrumented())
+        field->setInstrumented(true);
+    }
 
+    void addComputedField(ComputedFieldBase* computedField)
+    {
       std::set<DomainBase*> domains {this};
+      unsigned inputLevel = 0;
+
+      auto levelOf = [](FieldBase* field)
+      {
+        auto computed = dynamic_cast<ComputedFieldBase*>(field);
+        return computed != nullptr ? computed->getLevel() : 0u;
+      };
 
       // Set the computed field as a dependant of all listed fields
-      for (auto& field : fields)
+      for (auto& field : computedField->getDependencies())
+      {
+        field->addDependant(computedField);
+        domains.insert(&field->getDomain());
+        inputLevel = std::max(inputLevel, levelOf(field));
+      }
+
+      // Also set any involved foreign key fields as dependants
+      for (auto d1 : domains)
+      for (auto d2 : domains)
+      {
+        if (d1 == d2)
+          continue;
+        for (auto fk : d1->getRelationPathTo(*d2))
+        {
+          fk->addDependant(computedField);
+          inputLevel = std::max(inputLevel, levelOf(fk));
+        }
+      }
+
+      // Materialise multi-step paths to other domains now, rather than on the first change
+      for (auto domain : domains)
+      {
+        if (domain != this && getRelationPathTo(*domain).size() > 1)
+          getRelationPathIndex(*domain);
+      }
+
+      // Dependencies must already exist, so the graph is acyclic and the level is final
+      computedField->setLevel(inputLevel + 1);
+
+      auto pos = std::upper_bound(_computedFields.begin(), _computedFields.end(), computedField,
+        [](ComputedFieldBase* a, ComputedFieldBase* b) { return a->getLevel() < b->getLevel(); });
+      _computedFields.insert(pos, computedField);
+    }
+
+    std::vector<std::unique_ptr<FieldBase>> _fields;
+    std::vector<FieldBase*> _publishFields;
+    std::vector<FieldBase*> _publishingFields;
+    std::vector<ComputedFieldBase*> _computedFields;
+    size_t _dirtyFieldCount = 0;
+    std::map<DomainBase*,RelationFieldBase*> _foreignKeys;
+    std::map<DomainBase*,std::vector<RelationFieldBase*>> _relationPaths;
+    std::map<const DomainBase*,std::unique_ptr<RelationPathIndex>> _relationPathIndexes;
+    KeyDictionary<TKey> _keys;
+  };
+
+  /// An update to a field's value, queued by Graph::enqueue.
+  class QueuedUpdate : public MpscNode
+  {
+  public:
+    ~QueuedUpdate() override = default;
+
+    /// Finds the updated row, adding the key to its domain if new. Called oldest first, so that
+    /// keys first seen in the queue are assigned rows in the order queued.
+    virtual void assignRow() = 0;
+
+    /// Claims the updated row, returning false if the update is superseded by a newer update
+    /// to the same row. Sets \p field if this update is the first to claim a row of it.
+    virtual bool claim(FieldBase*& field) = 0;
+
+    /// Applies a claimed update.
+    virtual void apply() = 0;
+  };
+
+  template<typename TValue, typename TKey>
+  class FieldUpdate : public QueuedUpdate
+  {
+  public:
+    FieldUpdate(TypedFieldBase<TValue,TKey>& field, TKey key, TValue value)
+      : _field(field),
+        _key(std::move(key)),
+        _value(std::move(value)),
+        _row()
+    {}
+
+    ~FieldUpdate() override = default;
+
+    void assignRow() override
+    {
+      _row = static_cast<Domain<TKey>&>(_field.getDomain()).getOrAddRow(_key);
+    }
+
+    bool claim(FieldBase*& field) override
+    {
+      bool isFirst;
+      bool claimed = _field.claimQueuedRow(_row, isFirst);
+      if (isFirst)
+        field = &_field;
+      return claimed;
+    }
+
+    void apply() override
+    {
+      _field.applyQueuedValue(_row, _value);
+    }
+
+  private:
+    TypedFieldBase<TValue,TKey>& _field;
+    TKey _key;
+    TValue _value;
+    RowId _row;
+  };
+
+  /// Delivers published changes to subscribers on a dedicated thread.
+  ///
+  /// Publishing stages each field's changes into a buffer and returns at once. The publisher
+  /// thread takes the staged buffers, swapping them for empty ones, then delivers from them
+  /// while the next changes are staged, so the publishing thread never waits on subscribers.
+  /// If changes are staged before the publisher takes the previous ones, they accumulate in the
+  /// staged buffers according to the BackPressure policy.
+  class AsyncPublisher
+  {
+  public:
+    AsyncPublisher(BackPressure backPressure, size_t maxStagedChanges)
+      : _backPressure(backPressure),
+        _maxStagedChanges(maxStagedChanges),
+        _mutex(),
+        _wake(),
+        _idle(),
+        _publishFields(),
+        _stagedFields(),
+        _deliveringFields(),
+        _isDelivering(false),
+        _isStopping(false),
+        _droppedChangeCount(0),
+        _thread()
+    {
+      assert(backPressure != BackPressure::Bounded || maxStagedChanges != 0);
+      _thread = std::thread([this] { run(); });
+    }
+
+    /// Stops the publisher thread once it has delivered all staged changes.
+    ~AsyncPublisher()
+    {
       {
-        field->addDependant(ptr);
-        domains.insert(&field->getDomain());
+        std::lock_guard<std::mutex> lock(_mutex);
+        _isStopping = true;
       }
+      _wake.notify_one();
+      _thread.join();
+    }
 
-      // Also set any involved foreign key fields as dependants
-      for (auto d1 : domains)
-      for (auto d2 : domains)
+    /// Stages the changes of all \p domains for delivery, then runs their publish tasks.
+    void publish(const std::vector<std::unique_ptr<DomainBase>>& domains)
+    {
+      for (auto const& domain : domains)
+        domain->takePublishFields(_publishFields);
+
+      if (!_publishFields.empty())
       {
-        if (d1 == d2)
-          continue;
-        for (auto fk : d1->getRelationPathTo(*d2))
-          fk->addDependant(ptr);
+        {
+          // Held only while staging, and by the publisher only while taking staged changes
+          std::lock_guard<std::mutex> lock(_mutex);
+          for (FieldBase* field : _publishFields)
+            if (field->stagePublication(_backPressure, _maxStagedChanges, _droppedChangeCount))
+              _stagedFields.push_back(field);
+        }
+        _wake.notify_one();
+        _publishFields.clear();
       }
 
-      return *ptr;
+      for (auto const& domain : domains)
+        domain->runPublishTasks();
     }
 
-    void addPublishTask(std::function<void()>&& task)
+    /// Waits until all staged changes have been delivered.
+    void flush()
     {
-      _publishTasks.push_back(std::move(task));
+      std::unique_lock<std::mutex> lock(_mutex);
+      _idle.wait(lock, [this] { return _stagedFields.empty() && !_isDelivering; });
     }
 
-    void addComputeTask(std::function<void()>&& task) override
+    /// Gets the number of changes dropped by BackPressure::Bounded.
+    size_t getDroppedChangeCount() const
     {
-      _computeTasks.push_back(std::move(task));
+      std::lock_guard<std::mutex> lock(_mutex);
+      return _droppedChangeCount;
     }
 
-    bool isComputeRequired() const override
-    {
-      return !_computeTasks.empty();
-    }
+  private:
+    AsyncPublisher(const AsyncPublisher&) = delete;
+    AsyncPublisher& operator=(const AsyncPublisher&) = delete;
 
-    bool isPublishRequired() const override
+    void run()
     {
-      return !_publishTasks.empty();
+      while (true)
+      {
+        {
+          std::unique_lock<std::mutex> lock(_mutex);
+          _isDelivering = false;
+          _idle.notify_all();
+          _wake.wait(lock, [this] { return _isStopping || !_stagedFields.empty(); });
+          if (_stagedFields.empty())
+            return;
+
+          _deliveringFields.swap(_stagedFields);
+          for (FieldBase* field : _deliveringFields)
+            field->takeStagedPublication();
+          _isDelivering = true;
+        }
+
+        for (FieldBase* field : _deliveringFields)
+          field->deliverPublication();
+        _deliveringFields.clear();
+      }
     }
 
-    void compute() override
+    const BackPressure _backPressure;
+    const size_t _maxStagedChanges;
+    mutable std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    std::vector<FieldBase*> _publishFields;
+    std::vector<FieldBase*> _stagedFields;
+    std::vector<FieldBase*> _deliveringFields;
+    bool _isDelivering;
+    bool _isStopping;
+    size_t _droppedChangeCount;
+    std::thread _thread;
+  };
+
+  /// Records the values stored in a graph's fields, other than computed fields, to an
+  /// append-only file, so that they may be replayed after a restart (see Graph::replayJournal).
+  ///
+  /// The file begins with a header naming each recorded field, followed by a frame for each
+  /// compute cycle: the frame's length, then a record of each value stored during the cycle,
+  /// as the field's number, the key and the value. Fields encode records into memory as values
+  /// are stored, and each frame is handed to a BackgroundFileWriter, so that recording never
+  /// waits upon the disk.
+  class Journal
+  {
+  public:
+    static constexpr uint64_t Magic = 0x4c4e524a58554c46; // "FLUXJRNL"
+    static constexpr uint32_t Version = 1;
+
+    /// Creates a journal at \p path, replacing any file there, and begins recording the fields
+    /// of \p domains.
+    Journal(const std::string& path, const std::vector<std::unique_ptr<DomainBase>>& domains)
+      : _file(path),
+        _buffer(),
+        _stream(&_buffer),
+        _writer(_stream),
+        _fields()
     {
-      for (auto& task : _computeTasks)
-        task();
-      _computeTasks.clear();
+      for (auto const& domain : domains)
+        for (auto const& field : domain->getFields())
+          if (dynamic_cast<ComputedFieldBase*>(field.get()) == nullptr)
+            _fields.push_back(field.get());
+
+      _writer.write(Magic);
+      _writer.write(Version);
+      _writer.write<uint32_t>(static_cast<uint32_t>(_fields.size()));
+      for (FieldBase* field : _fields)
+      {
+        _writer.writeString(field->getDomain().getName());
+        _writer.beginSection(field->getName(), field->getTypeName());
+      }
+      auto& bytes = _buffer.getBytes();
+      _file.append(bytes.data(), bytes.size());
+      bytes.clear();
+      beginFrame();
+
+      for (uint32_t fieldId = 0; fieldId < _fields.size(); fieldId++)
+        _fields[fieldId]->setJournal(&_writer, fieldId);
     }
 
-    void publish() override
+    /// Stops recording. Values recorded since the last frame ended are discarded.
+    ~Journal()
     {
-      for (auto& task : _publishTasks)
-        task();
-      _publishTasks.clear();
+      for (FieldBase* field : _fields)
+        field->setJournal(nullptr, 0);
     }
 
-    const std::vector<RelationFieldBase*> getForeignKeys() const override
+    /// Ends the frame of the current cycle, handing it to be written if it records any values.
+    void endCycle()
     {
-      std::vector<RelationFieldBase*> fks;
-      for (auto const& pair : _foreignKeys)
-        fks.push_back(pair.second);
-      return fks;
+      auto& bytes = _buffer.getBytes();
+      if (bytes.size() == sizeof(uint64_t))
+        return;
+
+      uint64_t length = bytes.size() - sizeof(uint64_t);
+      std::memcpy(bytes.data(), &length, sizeof(length));
+      _file.append(bytes.data(), bytes.size());
+      bytes.clear();
+      beginFrame();
     }
 
-    const std::vector<RelationFieldBase*>& getRelationPathTo(const DomainBase& relatedDomain)
+    /// Waits until all ended frames are written. Throws std::runtime_error if writing failed.
+    void flush()
     {
-      DomainBase* relatedPtr = const_cast<DomainBase*>(&relatedDomain);
+      _file.flush();
+    }
 
-      // See if we have a cached result
-      auto cached = _relationPaths.find(relatedPtr);
-      if (cached != _relationPaths.end())
-        return cached->second;
+  private:
+    Journal(const Journal&) = delete;
+    Journal& operator=(const Journal&) = delete;
 
-      // No cached result, so create one...
+    void beginFrame()
+    {
+      // The length is filled in when the frame ends
+      _writer.write<uint64_t>(0);
+    }
 
-      // Test whether the related domain is a direct relation
-      auto direct = _foreignKeys.find(relatedPtr);
-      if (direct != _foreignKeys.end())
-      {
-        std::vector<RelationFieldBase*> keys {direct->second};
-        auto res = _relationPaths.emplace(relatedPtr, std::move(keys));
-        assert(res.second);
-        return res.first->second;
-      }
+    BackgroundFileWriter _file;
+    AppendBuffer _buffer;
+    std::ostream _stream;
+    BinaryWriter _writer;
+    std::vector<FieldBase*> _fields;
+  };
 
-      // The relationship is not direct, so search for an indirect one
+  /// The keys and values of every domain and field of a Graph, as they were at the end of a
+  /// compute. Snapshots are immutable, and so may be read from any thread while the graph
+  /// continues. See Graph::enableSnapshots.
+  class GraphSnapshot
+  {
+  public:
+    explicit GraphSnapshot(uint64_t version)
+      : _version(version),
+        _keys(),
+        _values()
+    {}
 
-      auto path = findPath<DomainBase*,RelationFieldBase*>(this, relatedPtr,
-        [](DomainBase* d)
-        {
-          std::queue<std::pair<RelationFieldBase*,DomainBase*>> edges;
-          for (auto fk : d->getForeignKeys())
-            edges.emplace(fk, &fk->getRemoteDomain());
-          return edges;
-        });
+    /// Gets the number of this snapshot, counting from one, which increases with each compute.
+    uint64_t getVersion() const { return _version; }
 
-      // Return just a vector of the relation fields
-      std::vector<RelationFieldBase*> fkPath;
-      for (auto const& p : path)
-        fkPath.push_back(p.first);
+    /// Returns the value \p field held for \p key, or null if it held none.
+    template<typename TValue, typename TKey, typename TLookup>
+    const TValue* find(const TypedFieldBase<TValue,TKey>& field, const TLookup& key) const
+    {
+      auto keys = static_cast<const KeySnapshot<TKey>*>(findKeys(&field.getDomain()));
+      auto values = static_cast<const ColumnSnapshot<TValue>*>(findValues(&field));
+      if (keys == nullptr || values == nullptr)
+        return nullptr;
+      RowId row = keys->find(key);
+      return values->has(row) ? &values->get(row) : nullptr;
+    }
 
-      // Memoize (move into cache)
-      auto res = _relationPaths.emplace(relatedPtr, move(fkPath));
-      assert(res.second);
+    template<typename TValue, typename TKey, typename TLookup>
+    const TValue& getValue(const TypedFieldBase<TValue,TKey>& field, const TLookup& key) const
+    {
+      const TValue* value = find(field, key);
+      if (value == nullptr)
+        throw std::runtime_error("No value exists for key");
+      return *value;
+    }
 
-      // Return reference to cached version
-      return res.first->second;
+    /// Gets the number of keys for which \p field held a value.
+    template<typename TValue, typename TKey>
+    size_t count(const TypedFieldBase<TValue,TKey>& field) const
+    {
+      auto values = static_cast<const ColumnSnapshot<TValue>*>(findValues(&field));
+      return values == nullptr ? 0 : values->count();
     }
 
-    const std::vector<std::unique_ptr<FieldBase>>& getFields() const override { return _fields; }
+  private:
+    GraphSnapshot(const GraphSnapshot&) = delete;
+    GraphSnapshot& operator=(const GraphSnapshot&) = delete;
 
-    any getRelatedKey(any key, const DomainBase& relatedDomain) override
-    {
-      assert(!key.empty());
-      assert(key.is<TKey>());
+    friend class Graph;
 
-      auto fks = getRelationPathTo(relatedDomain);
+    // Readers are given pointers rather than shared pointers, so that reading a snapshot does
+    // not contend with other readers over reference counts
 
-      if (fks.empty())
-        return any();
+    const void* findKeys(const DomainBase* domain) const
+    {
+      auto it = _keys.find(domain);
+      return it == _keys.end() ? nullptr : it->second.get();
+    }
 
-      for (auto fk : fks)
-      {
-        key = fk->getValue(key);
-//        if (key.empty())
-//          std::cout << "Key " << key << " produced no value in FK " << fk->getName() << std::endl;
-      }
+    const void* findValues(const FieldBase* field) const
+    {
+      auto it = _values.find(field);
+      return it == _values.end() ? nullptr : it->second.get();
+    }
 
-      return key;
+    std::shared_ptr<const void> sharedKeys(const DomainBase* domain) const
+    {
+      auto it = _keys.find(domain);
+      return it == _keys.end() ? nullptr : it->second;
     }
 
-  private:
-    Domain(const Domain&) = delete;
-    Domain& operator=(const Domain&) = delete;
+    std::shared_ptr<const void> sharedValues(const FieldBase* field) const
+    {
+      auto it = _values.find(field);
+      return it == _values.end() ? nullptr : it->second;
+    }
 
-    std::vector<std::unique_ptr<FieldBase>> _fields;
-    std::vector<std::function<void()>> _publishTasks;
-    std::vector<std::function<void()>> _computeTasks;
-    std::map<DomainBase*,RelationFieldBase*> _foreignKeys;
-    std::map<DomainBase*,std::vector<RelationFieldBase*>> _relationPaths;
+    uint64_t _version;
+    /// Each domain's KeySnapshot
+    std::unordered_map<const DomainBase*,std::shared_ptr<const void>> _keys;
+    /// Each field's ColumnSnapshot
+    std::unordered_map<const FieldBase*,std::shared_ptr<const void>> _values;
   };
 
+  /// A registered reader of a graph's snapshots. See Graph::createSnapshotReader.
+  typedef Versioned<GraphSnapshot>::Reader SnapshotReader;
+
   class Graph
   {
   public:
-    Graph() = default;
+    Graph()
+      : _domains(),
+        _schedule(),
+        _executor(),
+        _tasks(),
+        _updates(),
+        _drainedUpdates(),
+        _drainedFields(),
+        _snapshots(),
+        _isSnapshotting(false),
+        _isInstrumented(false),
+        _journal(),
+        _publisher()
+    {}
+
+    /// Sets the number of threads used to calculate computed fields, including the thread
+    /// calling compute. With one thread, the default, all calculation happens on the calling
+    /// thread. Otherwise calculations may run concurrently, and so must be safe to call from
+    /// several threads at once.
+    void setComputeThreads(size_t threadCount)
+    {
+      assert(threadCount != 0);
+      if (threadCount == 1)
+        _executor.reset();
+      else if (!_executor || _executor->getThreadCount() != threadCount)
+        _executor = std::make_unique<WorkStealingExecutor>(threadCount);
+    }
+
+    size_t getComputeThreads() const { return _executor ? _executor->getThreadCount() : 1; }
 
     template<typename TKey>
     Domain<TKey>& addDomain(std::string name)
     {
       auto domain = std::make_unique<Domain<TKey>>(name);
       Domain<TKey>& retVal = *domain;
+      retVal.setInstrumented(_isInstrumented);
       _domains.push_back(std::move(domain));
       return retVal;
     }
 
+    /// Starts or stops collecting FieldStats for every field of the graph, including those
+    /// created later. While stopped, each operation that would be counted or timed costs a
+    /// single branch. Stopping discards the stats collected. Once collected, stats are
+    /// available via FieldBase::getStats, and rendered by toDot.
+    void setInstrumented(bool isInstrumented)
+    {
+      _isInstrumented = isInstrumented;
+      for (auto const& domain : _domains)
+        domain->setInstrumented(isInstrumented);
+    }
+
+    bool isInstrumented() const { return _isInstrumented; }
+
+    /// Zeroes the stats of every field, such as to begin measuring a new interval.
+    void resetStats()
+    {
+      for (auto const& domain : _domains)
+        domain->resetStats();
+    }
+
     bool isComputeRequired() const
     {
       return std::any_of(_domains.begin(), _domains.end(),
@@ -711,24 +4081,311 @@ namespace flux
         [](const std::unique_ptr<DomainBase>& domain) { return domain->isPublishRequired(); });
     }
 
+    /// Queues an update of \p field's value for \p key. Unlike setValue, this may be called from
+    /// any thread, concurrently with other calls and with the thread using the graph, and never
+    /// blocks. Queued updates are applied at the start of the next compute. Updates queued by
+    /// one thread are applied in the order that thread queued them, but no order is promised
+    /// between updates queued concurrently by different threads. Where several updates to the
+    /// same key are queued, only the last is applied.
+    ///
+    /// Each call allocates the queued update on the heap, freeing it on the compute thread once
+    /// applied, so enqueue is not allocation free on the calling thread.
+    template<typename TValue, typename TKey>
+    void enqueue(TypedFieldBase<TValue,TKey>& field, typename TypedFieldBase<TValue,TKey>::KeyType key, TValue value)
+    {
+      _updates.push(std::make_unique<FieldUpdate<TValue,TKey>>(field, std::move(key), std::move(value)));
+    }
+
+    /// Calculates all dirty computed fields across all domains.
+    ///
+    /// Fields are calculated in order of level (see ComputedFieldBase::getLevel) so that, no matter
+    /// which domains are involved, each computed field is calculated once per cycle and only after
+    /// all of its inputs are final.
+    ///
+    /// When several compute threads are set, fields of the same level do not depend upon one
+    /// another, so the dirty rows of each level are split into chunks that are calculated
+    /// concurrently. Results are stored once the whole level is calculated, on the calling
+    /// thread and in the same order as a serial compute, so observers see identical changes.
     void compute()
     {
-      for (auto const& domain : _domains)
-        domain->compute();
+      applyQueuedUpdates();
+      updateSchedule();
+
+      // Compute tasks may set further inputs, so continue until nothing remains
+      while (isComputeRequired())
+      {
+        for (auto const& domain : _domains)
+          domain->runComputeTasks();
+
+        for (size_t begin = 0; begin != _schedule.size(); )
+        {
+          // Find the fields sharing this level
+          size_t end = begin + 1;
+          while (end != _schedule.size() && _schedule[end]->getLevel() == _schedule[begin]->getLevel())
+            end++;
+          computeLevel(begin, end);
+          begin = end;
+        }
+      }
+
+      if (_journal)
+        _journal->endCycle();
+
+      if (_isSnapshotting)
+        takeSnapshot();
     }
 
+    /// Notifies subscribers of all changes since the previous publish. Unless a publish thread
+    /// is running, subscribers are notified before this returns.
     void publish()
     {
+      if (_publisher)
+      {
+        _publisher->publish(_domains);
+        return;
+      }
+
       for (auto const& domain : _domains)
         domain->publish();
     }
 
+    /// Starts a thread that notifies subscribers, so that publish returns without waiting for
+    /// them. Subscribers are then called on that thread, and must not modify the graph other
+    /// than via enqueue, though they may subscribe and unsubscribe. Changes published while the thread is still delivering earlier ones
+    /// are held according to \p backPressure, with \p maxStagedChanges limiting the changes
+    /// held per field for BackPressure::Bounded.
+    void startPublishThread(BackPressure backPressure = BackPressure::Conflate, size_t maxStagedChanges = 0)
+    {
+      _publisher.reset();
+      _publisher = std::make_unique<AsyncPublisher>(backPressure, maxStagedChanges);
+    }
+
+    /// Stops the publish thread, once it has delivered all published changes. Later publishes
+    /// notify subscribers on the publishing thread.
+    void stopPublishThread()
+    {
+      _publisher.reset();
+    }
+
+    /// Waits until the publish thread, if any, has delivered all published changes.
+    void flushPublish()
+    {
+      if (_publisher)
+        _publisher->flush();
+    }
+
+    /// Takes a GraphSnapshot of the current keys and values, and another at the end of every
+    /// compute from now on. Threads other than the one using the graph may read the latest
+    /// snapshot via a SnapshotReader, without locking and while later computes run.
+    ///
+    /// Each snapshot copies only the chunks of values that changed since the one before,
+    /// sharing the rest. Snapshots are freed by the next compute after their last reader
+    /// releases them.
+    void enableSnapshots()
+    {
+      if (_isSnapshotting)
+        return;
+      _isSnapshotting = true;
+      takeSnapshot();
+    }
+
+    /// Registers a reader of snapshots. Readers may be created on any thread, and used on one
+    /// thread at a time, and must be destroyed before the graph. For example:
+    ///
+    ///     SnapshotReader reader = graph.createSnapshotReader();
+    ///     auto snapshot = reader.pin();
+    ///     const double* price = snapshot->find(px, "VOD");
+    SnapshotReader createSnapshotReader()
+    {
+      return _snapshots.addReader();
+    }
+
+    /// Writes a checkpoint of every domain's keys and every field's values, including relations
+    /// and their indexes and the values of computed fields, to the file at \p path. Reading it
+    /// back with loadCheckpoint restores the graph without recalculating anything.
+    void saveCheckpoint(const std::string& path) const
+    {
+      requireBinaryCodable();
+      std::ofstream out(path, std::ios::binary | std::ios::trunc);
+      if (!out)
+        throw std::runtime_error("Unable to create " + path);
+      writeCheckpoint(out);
+      out.close();
+      if (!out)
+        throw std::runtime_error("Failed to write " + path);
+    }
+
+    /// Writes a checkpoint to \p out. See saveCheckpoint.
+    void writeCheckpoint(std::ostream& out) const
+    {
+      if (isComputeRequired())
+        throw std::runtime_error("A graph cannot be checkpointed while compute is required");
+      requireBinaryCodable();
+
+      CheckpointWriter writer(out);
+      writer.write<uint64_t>(_domains.size());
+      for (auto const& domain : _domains)
+        domain->writeCheckpoint(writer);
+      for (auto const& domain : _domains)
+      {
+        writer.write<uint64_t>(domain->getFields().size());
+        for (auto const& field : domain->getFields())
+          field->writeCheckpoint(writer);
+      }
+    }
+
+    /// Reads the checkpoint at \p path, which is memory mapped, so that the values of
+    /// trivially copyable types are bulk copied from the page cache.
+    ///
+    /// The graph must have the domains and fields the checkpoint was written from, created in
+    /// the same order, and must not yet have assigned any keys. Dependants and subscribers are
+    /// not notified of the values read. If the checkpoint does not match the graph,
+    /// std::runtime_error is thrown and the graph is left partially read.
+    void loadCheckpoint(const std::string& path)
+    {
+      MappedFile file(path);
+      readCheckpoint(file.data(), file.size());
+    }
+
+    /// Reads the checkpoint of \p size bytes at \p data. See loadCheckpoint.
+    void readCheckpoint(const char* data, size_t size)
+    {
+      requireBinaryCodable();
+      CheckpointReader reader(data, size);
+      if (reader.read<uint64_t>() != _domains.size())
+        throw std::runtime_error("Checkpoint holds a different number of domains");
+      for (auto const& domain : _domains)
+        domain->readCheckpoint(reader);
+      for (auto const& domain : _domains)
+      {
+        if (reader.read<uint64_t>() != domain->getFields().size())
+          throw std::runtime_error("Checkpoint holds a different number of fields of " + domain->getName());
+        for (auto const& field : domain->getFields())
+          field->readCheckpoint(reader);
+      }
+      if (!reader.isAtEnd())
+        throw std::runtime_error("Checkpoint holds more than the graph");
+
+      for (auto const& domain : _domains)
+        domain->rebuildRelationPathIndexes();
+
+      if (_isSnapshotting)
+        takeSnapshot();
+    }
+
+    /// Starts recording every value stored in a field, other than computed fields, to a journal
+    /// at \p path, replacing any file there. The values stored in each compute cycle, whether
+    /// set directly, in bulk or via enqueue, are written as a frame once compute ends, by a
+    /// background thread. Fields created after the journal starts are not recorded.
+    ///
+    /// Throws std::runtime_error, without replacing the file or any journal already started, if
+    /// a field to be recorded has a key or value type that BinaryCodec does not support.
+    void startJournal(const std::string& path)
+    {
+      for (auto const& domain : _domains)
+        for (auto const& field : domain->getFields())
+          if (dynamic_cast<ComputedFieldBase*>(field.get()) == nullptr && !field->isBinaryCodable())
+            throw std::runtime_error("Field " + domain->getName() + "." + field->getName() + " cannot be journalled, as BinaryCodec does not support its key or value type");
+
+      _journal.reset();
+      _journal = std::make_unique<Journal>(path, _domains);
+    }
+
+    /// Stops recording, once values stored since the last compute are written as a final frame.
+    void stopJournal()
+    {
+      if (!_journal)
+        return;
+      _journal->endCycle();
+      _journal->flush();
+      _journal.reset();
+    }
+
+    /// Waits until the frames of all completed compute cycles are written to the journal.
+    void flushJournal()
+    {
+      if (_journal)
+        _journal->flush();
+    }
+
+    /// Replays the journal at \p path, typically after loadCheckpoint. The values of each frame
+    /// are set in bulk, with dependants notified once per field, followed by a compute, so the
+    /// graph passes through the same cycles as when the journal was recorded. Subscribers are
+    /// not notified until the next publish. Returns the number of cycles replayed.
+    ///
+    /// Recorded fields are found by name. A final frame left incomplete by a crash is ignored.
+    size_t replayJournal(const std::string& path)
+    {
+      MappedFile file(path);
+      BinaryReader reader(file.data(), file.size());
+      if (reader.read<uint64_t>() != Journal::Magic)
+        throw std::runtime_error("Not a journal");
+      if (reader.read<uint32_t>() != Journal::Version)
+        throw std::runtime_error("Unsupported journal version");
+
+      std::vector<FieldBase*> fields(reader.read<uint32_t>());
+      for (FieldBase*& field : fields)
+      {
+        std::string domainName = reader.readString();
+        std::string fieldName = reader.readString();
+        std::string typeName = reader.readString();
+        DomainBase* domain = findDomain(domainName);
+        field = domain != nullptr ? domain->findField(fieldName) : nullptr;
+        if (field == nullptr)
+          throw std::runtime_error("Journal records " + domainName + "." + fieldName + " which the graph lacks");
+        if (field->getTypeName() != typeName)
+          throw std::runtime_error("Journal records " + domainName + "." + fieldName + " of a different type");
+      }
+
+      std::vector<bool> isReplayed(fields.size());
+      std::vector<FieldBase*> replayedFields;
+      size_t cycleCount = 0;
+      while (reader.getRemaining() >= sizeof(uint64_t))
+      {
+        size_t length = reader.read<uint64_t>();
+        if (length > reader.getRemaining())
+          break;
+
+        size_t end = reader.getOffset() + length;
+        while (reader.getOffset() < end)
+        {
+          uint32_t fieldId = reader.read<uint32_t>();
+          if (fieldId >= fields.size())
+            throw std::runtime_error("Journal is malformed");
+          fields[fieldId]->readJournalValue(reader);
+          if (!isReplayed[fieldId])
+          {
+            isReplayed[fieldId] = true;
+            replayedFields.push_back(fields[fieldId]);
+          }
+        }
+
+        for (FieldBase* field : replayedFields)
+          field->endQueuedValues();
+        std::fill(isReplayed.begin(), isReplayed.end(), false);
+        replayedFields.clear();
+
+        compute();
+        cycleCount++;
+      }
+      return cycleCount;
+    }
+
+    /// Gets the number of changes the publish thread has dropped under BackPressure::Bounded.
+    size_t getDroppedChangeCount() const
+    {
+      return _publisher ? _publisher->getDroppedChangeCount() : 0;
+    }
+
     std::vector<std::unique_ptr<DomainBase>>::iterator begin() { return _domains.begin(); }
     std::vector<std::unique_ptr<DomainBase>>::iterator end()   { return _domains.end(); }
 
     std::vector<std::unique_ptr<DomainBase>>::const_iterator begin() const { return _domains.begin(); }
     std::vector<std::unique_ptr<DomainBase>>::const_iterator end()   const { return _domains.end(); }
 
+    /// Writes the graph in the Graphviz dot language. Fields with stats are labelled with them,
+    /// and shaded from white to red by the time spent computing and publishing them, relative
+    /// to the field that spent the most.
     void toDot(std::ostream& o) const;
 
     DomainBase* findDomain(std::string domainName) const
@@ -744,6 +4401,147 @@ namespace flux
     Graph(const Graph&) = delete;
     Graph& operator=(const Graph&) = delete;
 
+    /// Throws std::runtime_error, before anything is written or read, if any domain or field
+    /// cannot be checkpointed.
+    void requireBinaryCodable() const
+    {
+      for (auto const& domain : _domains)
+      {
+        if (!domain->isBinaryCodable())
+          throw std::runtime_error("Domain " + domain->getName() + " cannot be checkpointed, as BinaryCodec does not support its key type");
+        for (auto const& field : domain->getFields())
+          if (!field->isBinaryCodable())
+            throw std::runtime_error("Field " + domain->getName() + "." + field->getName() + " cannot be checkpointed, as BinaryCodec does not support its key or value type");
+      }
+    }
+
+    void updateSchedule()
+    {
+      size_t computedFieldCount = 0;
+      for (auto const& domain : _domains)
+        computedFieldCount += domain->getComputedFields().size();
+
+      if (computedFieldCount == _schedule.size())
+        return;
+
+      // Computed fields have been added since the schedule was built
+      _schedule.clear();
+      for (auto const& domain : _domains)
+        _schedule.insert(_schedule.end(), domain->getComputedFields().begin(), domain->getComputedFields().end());
+      std::stable_sort(_schedule.begin(), _schedule.end(),
+        [](ComputedFieldBase* a, ComputedFieldBase* b) { return a->getLevel() < b->getLevel(); });
+    }
+
+    /// The minimum number of rows in a chunk of concurrent calculation. Smaller levels are
+    /// calculated serially, where the cost of waking threads would outweigh the gain.
+    static const size_t ChunkSize = 512;
+
+    struct ChunkTask
+    {
+      ComputedFieldBase* field;
+      size_t begin;
+      size_t end;
+    };
+
+    /// Calculates the dirty rows of the scheduled fields in [begin, end), which share a level.
+    void computeLevel(size_t begin, size_t end)
+    {
+      size_t dirtyCount = 0;
+      if (_executor)
+      {
+        for (size_t i = begin; i != end; i++)
+          dirtyCount += _schedule[i]->getDirtyCount();
+      }
+
+      if (dirtyCount < ChunkSize * 2)
+      {
+        for (size_t i = begin; i != end; i++)
+          _schedule[i]->computeDirty();
+        return;
+      }
+
+      _tasks.clear();
+      for (size_t i = begin; i != end; i++)
+      {
+        ComputedFieldBase* field = _schedule[i];
+        size_t count = field->beginConcurrentCompute();
+        for (size_t row = 0; row < count; row += ChunkSize)
+          _tasks.push_back(ChunkTask{field, row, std::min(row + ChunkSize, count)});
+      }
+
+      _executor->parallelFor(_tasks.size(), [this](size_t i)
+      {
+        auto const& task = _tasks[i];
+        task.field->computeRange(task.begin, task.end);
+      });
+
+      for (size_t i = begin; i != end; i++)
+        _schedule[i]->endConcurrentCompute();
+    }
+
+    void takeSnapshot()
+    {
+      const GraphSnapshot* previous = _snapshots.getCurrent();
+      auto snapshot = std::make_unique<GraphSnapshot>(previous != nullptr ? previous->getVersion() + 1 : 1);
+
+      for (auto const& domain : _domains)
+      {
+        snapshot->_keys.emplace(domain.get(), domain->snapshotKeys(previous != nullptr ? previous->sharedKeys(domain.get()) : nullptr));
+        for (auto const& field : domain->getFields())
+          snapshot->_values.emplace(field.get(), field->snapshotValues(previous != nullptr ? previous->sharedValues(field.get()) : nullptr));
+      }
+
+      _snapshots.publish(std::move(snapshot));
+    }
+
+    /// Applies all updates queued by enqueue, conflated per key, then notifies dependants once
+    /// per updated field.
+    void applyQueuedUpdates()
+    {
+      while (auto update = _updates.pop())
+        _drainedUpdates.push_back(std::move(update));
+
+      if (_drainedUpdates.empty())
+        return;
+
+      // Oldest first, assign rows to new keys so that they take the order they were queued in
+      for (auto const& update : _drainedUpdates)
+        update->assignRow();
+
+      // Newest first, find which updates are superseded by later ones to the same key
+      for (auto it = _drainedUpdates.rbegin(); it != _drainedUpdates.rend(); ++it)
+      {
+        FieldBase* field = nullptr;
+        if (!(*it)->claim(field))
+          it->reset();
+        if (field != nullptr)
+          _drainedFields.push_back(field);
+      }
+
+      // Oldest first, apply the remainder so that observers see changes in the order queued
+      for (auto const& update : _drainedUpdates)
+        if (update)
+          update->apply();
+
+      for (FieldBase* field : _drainedFields)
+        field->endQueuedValues();
+
+      _drainedUpdates.clear();
+      _drainedFields.clear();
+    }
+
     std::vector<std::unique_ptr<DomainBase>> _domains;
+    std::vector<ComputedFieldBase*> _schedule;
+    std::unique_ptr<WorkStealingExecutor> _executor;
+    std::vector<ChunkTask> _tasks;
+    MpscQueue<QueuedUpdate> _updates;
+    std::vector<std::unique_ptr<QueuedUpdate>> _drainedUpdates;
+    std::vector<FieldBase*> _drainedFields;
+    Versioned<GraphSnapshot> _snapshots;
+    bool _isSnapshotting;
+    bool _isInstrumented;
+    std::unique_ptr<Journal> _journal;
+    /// Declared after _domains, so that it stops delivering before fields are destroyed
+    std::unique_ptr<AsyncPublisher> _publisher;
   };
 }
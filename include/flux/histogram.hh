@@ -0,0 +1,107 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+
+namespace flux
+{
+  /// Counts recorded values in buckets of logarithmic width, after HDR histograms, so that any
+  /// value up to 2^64 is recorded in constant time and space, with a bounded relative error.
+  ///
+  /// Values below 2^SubBucketBits have a bucket each. Above that, each power of two is split
+  /// into 2^(SubBucketBits - 1) equal buckets, so percentiles are reported within about 3%.
+  /// Buckets are allocated on the first record.
+  class Histogram
+  {
+  public:
+    static constexpr unsigned SubBucketBits = 6;
+
+    Histogram()
+      : _counts(),
+        _count(0),
+        _sum(0),
+        _min(std::numeric_limits<uint64_t>::max()),
+        _max(0)
+    {}
+
+    void record(uint64_t value)
+    {
+      if (_counts.empty())
+        _counts.resize(BucketCount, 0);
+      _counts[bucketOf(value)]++;
+      _count++;
+      _sum += value;
+      _min = std::min(_min, value);
+      _max = std::max(_max, value);
+    }
+
+    uint64_t getCount() const { return _count; }
+    uint64_t getSum() const { return _sum; }
+    uint64_t getMin() const { return _count == 0 ? 0 : _min; }
+    uint64_t getMax() const { return _max; }
+    double getMean() const { return _count == 0 ? 0 : double(_sum) / _count; }
+
+    /// Gets the value which \p percentile percent of recorded values are no greater than,
+    /// rounded up to the upper bound of its bucket.
+    uint64_t getPercentile(double percentile) const
+    {
+      assert(percentile >= 0 && percentile <= 100);
+
+      if (_count == 0)
+        return 0;
+
+      uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(percentile / 100 * _count)));
+      uint64_t cumulative = 0;
+      for (size_t bucket = 0; bucket < _counts.size(); bucket++)
+      {
+        cumulative += _counts[bucket];
+        if (cumulative >= rank)
+          return std::min(upperBoundOf(bucket), _max);
+      }
+      return _max;
+    }
+
+    void reset()
+    {
+      std::fill(_counts.begin(), _counts.end(), 0);
+      _count = 0;
+      _sum = 0;
+      _min = std::numeric_limits<uint64_t>::max();
+      _max = 0;
+    }
+
+  private:
+    static constexpr uint64_t HalfSubBucketCount = uint64_t(1) << (SubBucketBits - 1);
+    static constexpr size_t BucketCount = (66 - SubBucketBits) * HalfSubBucketCount;
+
+    static size_t bucketOf(uint64_t value)
+    {
+      if (value < HalfSubBucketCount * 2)
+        return static_cast<size_t>(value);
+
+      // Keep the top SubBucketBits bits of the value, and note how many were dropped
+      unsigned shift = 63 - __builtin_clzll(value) - (SubBucketBits - 1);
+      return static_cast<size_t>(shift * HalfSubBucketCount + (value >> shift));
+    }
+
+    static uint64_t upperBoundOf(size_t bucket)
+    {
+      if (bucket < HalfSubBucketCount * 2)
+        return bucket;
+
+      unsigned shift = static_cast<unsigned>(bucket / HalfSubBucketCount - 1);
+      uint64_t top = bucket - shift * HalfSubBucketCount;
+      return ((top + 1) << shift) - 1;
+    }
+
+    std::vector<uint64_t> _counts;
+    uint64_t _count;
+    uint64_t _sum;
+    uint64_t _min;
+    uint64_t _max;
+  };
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <condition_variable>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <stdexcept>
+#include <streambuf>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace flux
+{
+  /// A stream buffer that appends to a vector of bytes, so that a std::ostream may write into
+  /// memory which is reused after each batch is taken.
+  class AppendBuffer : public std::streambuf
+  {
+  public:
+    AppendBuffer()
+      : _bytes()
+    {}
+
+    std::vector<char>& getBytes() { return _bytes; }
+
+  protected:
+    std::streamsize xsputn(const char* data, std::streamsize size) override
+    {
+      _bytes.insert(_bytes.end(), data, data + size);
+      return size;
+    }
+
+    int_type overflow(int_type c) override
+    {
+      if (!traits_type::eq_int_type(c, traits_type::eof()))
+        _bytes.push_back(traits_type::to_char_type(c));
+      return traits_type::not_eof(c);
+    }
+
+  private:
+    AppendBuffer(const AppendBuffer&) = delete;
+    AppendBuffer& operator=(const AppendBuffer&) = delete;
+
+    std::vector<char> _bytes;
+  };
+
+  /// Appends to a file from a background thread, so that appending never waits upon the disk.
+  ///
+  /// Bytes appended while the thread is writing accumulate, and are written and flushed
+  /// together once it finishes, so batches grow to match the speed of the disk. Buffers are
+  /// swapped rather than copied, and reused, so steady appending does not allocate.
+  class BackgroundFileWriter
+  {
+  public:
+    /// Creates or truncates the file at \p path.
+    explicit BackgroundFileWriter(const std::string& path)
+      : _out(path, std::ios::binary | std::ios::trunc),
+        _mutex(),
+        _wake(),
+        _idle(),
+        _pending(),
+        _writing(),
+        _isWriting(false),
+        _hasFailed(false),
+        _stopping(false),
+        _thread()
+    {
+      if (!_out)
+        throw std::runtime_error("Unable to create " + path);
+      _thread = std::thread([this] { run(); });
+    }
+
+    /// Writes all appended bytes, then closes the file.
+    ~BackgroundFileWriter()
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+      }
+      _wake.notify_one();
+      _thread.join();
+    }
+
+    /// Appends \p size bytes at \p data, to be written by the background thread.
+    void append(const char* data, size_t size)
+    {
+      {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _pending.insert(_pending.end(), data, data + size);
+      }
+      _wake.notify_one();
+    }
+
+    /// Waits until all appended bytes are written and flushed. Throws std::runtime_error if
+    /// any write failed.
+    void flush()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      _idle.wait(lock, [this] { return _pending.empty() && !_isWriting; });
+      if (_hasFailed)
+        throw std::runtime_error("Failed to write file");
+    }
+
+  private:
+    BackgroundFileWriter(const BackgroundFileWriter&) = delete;
+    BackgroundFileWriter& operator=(const BackgroundFileWriter&) = delete;
+
+    void run()
+    {
+      std::unique_lock<std::mutex> lock(_mutex);
+      while (true)
+      {
+        _wake.wait(lock, [this] { return _stopping || !_pending.empty(); });
+        if (_pending.empty())
+          return;
+
+        _writing.swap(_pending);
+        _isWriting = true;
+        lock.unlock();
+
+        _out.write(_writing.data(), static_cast<std::streamsize>(_writing.size()));
+        _out.flush();
+        bool hasFailed = !_out;
+        _writing.clear();
+
+        lock.lock();
+        _isWriting = false;
+        _hasFailed = _hasFailed || hasFailed;
+        _idle.notify_all();
+      }
+    }
+
+    std::ofstream _out;
+    std::mutex _mutex;
+    std::condition_variable _wake;
+    std::condition_variable _idle;
+    /// Bytes appended since the thread last began writing
+    std::vector<char> _pending;
+    /// Bytes being written, accessed only by the thread
+    std::vector<char> _writing;
+    bool _isWriting;
+    bool _hasFailed;
+    bool _stopping;
+    std::thread _thread;
+  };
+}
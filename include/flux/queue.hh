@@ -0,0 +1,114 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <memory>
+
+namespace flux
+{
+  /// Base of elements of an MpscQueue. The link is embedded in the element, so a push
+  /// allocates nothing beyond the element itself.
+  class MpscNode
+  {
+  public:
+    MpscNode() : _next(nullptr) {}
+    virtual ~MpscNode() = default;
+
+  private:
+    MpscNode(const MpscNode&) = delete;
+    MpscNode& operator=(const MpscNode&) = delete;
+
+    template<typename T>
+    friend class MpscQueue;
+
+    std::atomic<MpscNode*> _next;
+  };
+
+  /// An unbounded, lock-free queue with many producers and a single consumer, after Dmitry
+  /// Vyukov's intrusive MPSC queue.
+  ///
+  /// Pushing is a single atomic exchange, and so never blocks or waits upon other producers.
+  /// Elements are popped in the order their pushes completed. A producer that has been
+  /// preempted part way through a push may briefly hide the elements pushed after it, in
+  /// which case pop returns nothing until that push completes.
+  template<typename T>
+  class MpscQueue
+  {
+  public:
+    MpscQueue()
+      : _head(&_stub),
+        _tail(&_stub),
+        _stub()
+    {}
+
+    ~MpscQueue()
+    {
+      while (pop())
+        ;
+    }
+
+    /// Adds \p element to the queue. May be called from any thread.
+    void push(std::unique_ptr<T> element)
+    {
+      assert(element);
+      push(static_cast<MpscNode*>(element.release()));
+    }
+
+    /// Removes the oldest element from the queue, or returns null if there is none. Must only
+    /// be called from one thread at a time.
+    std::unique_ptr<T> pop()
+    {
+      MpscNode* tail = _tail;
+      MpscNode* next = tail->_next.load(std::memory_order_acquire);
+
+      // Skip over the stub
+      if (tail == &_stub)
+      {
+        if (next == nullptr)
+          return nullptr;
+        _tail = next;
+        tail = next;
+        next = next->_next.load(std::memory_order_acquire);
+      }
+
+      if (next != nullptr)
+      {
+        _tail = next;
+        return std::unique_ptr<T>(static_cast<T*>(tail));
+      }
+
+      // The tail is the last element, unless a push is part way through
+      if (tail != _head.load(std::memory_order_acquire))
+        return nullptr;
+
+      // Push the stub behind the tail, so that the tail may be unlinked
+      push(&_stub);
+
+      next = tail->_next.load(std::memory_order_acquire);
+      if (next != nullptr)
+      {
+        _tail = next;
+        return std::unique_ptr<T>(static_cast<T*>(tail));
+      }
+
+      return nullptr;
+    }
+
+  private:
+    MpscQueue(const MpscQueue&) = delete;
+    MpscQueue& operator=(const MpscQueue&) = delete;
+
+    void push(MpscNode* node)
+    {
+      node->_next.store(nullptr, std::memory_order_relaxed);
+      MpscNode* prior = _head.exchange(node, std::memory_order_acq_rel);
+      prior->_next.store(node, std::memory_order_release);
+    }
+
+    /// The most recently pushed node, written by producers
+    std::atomic<MpscNode*> _head;
+    /// The oldest node, read and written only by the consumer
+    MpscNode* _tail;
+    MpscNode _stub;
+  };
+}
@@ -0,0 +1,390 @@
+#pragma once
+
+#include <cassert>
+#include <cstddef>
+#include <utility>
+#include <vector>
+
+#include "checkpoint.hh"
+
+namespace flux
+{
+  // Accumulators for use with Domain::accumulate. Each is copied once per row, and receives
+  // a sample via add whenever its row's inputs change, updating in constant time. Each has a
+  // BinaryCodec, below, so that it is written to checkpoints.
+
+  /// Holds up to a fixed number of the most recent values added, overwriting the oldest once full.
+  /// Alternatively, pushBack and popFront use it as a queue whose storage grows as needed and is
+  /// reused as values are removed.
+  template<typename T>
+  class RingBuffer
+  {
+  public:
+    explicit RingBuffer(size_t capacity)
+      : _values(capacity),
+        _begin(0),
+        _size(0)
+    {
+      assert(capacity != 0);
+    }
+
+    /// Adds \p value, returning whether the buffer was full, in which case the oldest value
+    /// is overwritten and moved into \p evicted.
+    bool push(T value, T& evicted)
+    {
+      size_t end = (_begin + _size) % _values.size();
+      if (_size == _values.size())
+      {
+        evicted = std::move(_values[end]);
+        _values[end] = std::move(value);
+        _begin = (_begin + 1) % _values.size();
+        return true;
+      }
+      _values[end] = std::move(value);
+      _size++;
+      return false;
+    }
+
+    /// Adds \p value, doubling the capacity first if the buffer is full.
+    void pushBack(T value)
+    {
+      if (_size == _values.size())
+      {
+        std::vector<T> values(_values.size() * 2);
+        for (size_t i = 0; i < _size; i++)
+          values[i] = std::move(_values[(_begin + i) % _values.size()]);
+        _values.swap(values);
+        _begin = 0;
+      }
+      _values[(_begin + _size) % _values.size()] = std::move(value);
+      _size++;
+    }
+
+    /// Removes the oldest value, keeping its storage for reuse.
+    void popFront()
+    {
+      assert(_size != 0);
+      _begin = (_begin + 1) % _values.size();
+      _size--;
+    }
+
+    const T& front() const { return (*this)[0]; }
+    const T& back() const { return (*this)[_size - 1]; }
+
+    bool empty() const { return _size == 0; }
+    size_t size() const { return _size; }
+    size_t capacity() const { return _values.size(); }
+
+    /// Gets the \p i'th value held, oldest first.
+    const T& operator[](size_t i) const
+    {
+      assert(i < _size);
+      return _values[(_begin + i) % _values.size()];
+    }
+
+  private:
+    std::vector<T> _values;
+    size_t _begin;
+    size_t _size;
+  };
+
+  /// Sums the most recent \p count samples.
+  template<typename T>
+  class RollingSum
+  {
+  public:
+    explicit RollingSum(size_t count)
+      : _window(count),
+        _sum()
+    {}
+
+    void add(const T& value)
+    {
+      T evicted;
+      if (_window.push(value, evicted))
+        _sum -= evicted;
+      _sum += value;
+    }
+
+    T get() const { return _sum; }
+
+    size_t size() const { return _window.size(); }
+
+  private:
+    template<typename, typename> friend struct BinaryCodec;
+
+    RingBuffer<T> _window;
+    T _sum;
+  };
+
+  /// Averages the most recent \p count samples.
+  class MovingAverage
+  {
+  public:
+    explicit MovingAverage(size_t count)
+      : _sum(count)
+    {}
+
+    void add(double value) { _sum.add(value); }
+
+    double get() const { return _sum.get() / _sum.size(); }
+
+  private:
+    template<typename, typename> friend struct BinaryCodec;
+
+    RollingSum<double> _sum;
+  };
+
+  /// An exponentially weighted moving average, in which each sample has weight \p alpha and
+  /// the average of those before has weight 1 - \p alpha. The first sample is taken as is.
+  class Ewma
+  {
+  public:
+    explicit Ewma(double alpha)
+      : _alpha(alpha),
+        _average(0),
+        _isEmpty(true)
+    {
+      assert(alpha > 0 && alpha <= 1);
+    }
+
+    void add(double value)
+    {
+      _average = _isEmpty ? value : _average + _alpha * (value - _average);
+      _isEmpty = false;
+    }
+
+    double get() const { return _average; }
+
+  private:
+    template<typename, typename> friend struct BinaryCodec;
+
+    double _alpha;
+    double _average;
+    bool _isEmpty;
+  };
+
+  /// The volume weighted average price of samples of price and quantity, over the most recent
+  /// \p count samples, or all samples if \p count is zero.
+  class Vwap
+  {
+  public:
+    explicit Vwap(size_t count = 0)
+      : _window(count == 0 ? 1 : count),
+        _isWindowed(count != 0),
+        _notional(0),
+        _quantity(0)
+    {}
+
+    template<typename TPrice, typename TQuantity>
+    void add(const TPrice& price, const TQuantity& quantity)
+    {
+      Sample sample{double(price) * quantity, double(quantity)};
+      Sample evicted;
+      if (_isWindowed && _window.push(sample, evicted))
+      {
+        _notional -= evicted.notional;
+        _quantity -= evicted.quantity;
+      }
+      _notional += sample.notional;
+      _quantity += sample.quantity;
+    }
+
+    double get() const { return _quantity == 0 ? 0 : _notional / _quantity; }
+
+  private:
+    template<typename, typename> friend struct BinaryCodec;
+
+    struct Sample
+    {
+      double notional;
+      double quantity;
+    };
+
+    RingBuffer<Sample> _window;
+    bool _isWindowed;
+    double _notional;
+    double _quantity;
+  };
+
+  /// Averages the samples whose times fall within \p duration of the latest, where a sample
+  /// is a time and value. Times must not decrease.
+  ///
+  /// Samples are evicted only when a later one is added, so the window ends at the latest
+  /// sample rather than the current time, and a key that stops receiving samples keeps
+  /// reporting the average of its last window. Samples are held in a ring buffer that grows to
+  /// the most samples the window has held, after which adding samples does not allocate.
+  template<typename TTime, typename TDuration = TTime>
+  class TimeWindowAverage
+  {
+  public:
+    explicit TimeWindowAverage(TDuration duration)
+      : _duration(duration),
+        _samples(1),
+        _sum(0)
+    {
+      assert(TDuration() < duration);
+    }
+
+    void add(const TTime& time, double value)
+    {
+      assert(_samples.empty() || !(time < _samples.back().time));
+      _samples.pushBack(Sample{time, value});
+      _sum += value;
+      while (!(time - _samples.front().time < _duration))
+      {
+        _sum -= _samples.front().value;
+        _samples.popFront();
+      }
+    }
+
+    double get() const { return _samples.empty() ? 0 : _sum / _samples.size(); }
+
+    size_t size() const { return _samples.size(); }
+
+  private:
+    template<typename, typename> friend struct BinaryCodec;
+
+    struct Sample
+    {
+      TTime time;
+      double value;
+    };
+
+    TDuration _duration;
+    RingBuffer<Sample> _samples;
+    double _sum;
+  };
+
+  // Codecs writing each accumulator's configuration along with its samples, so that one read
+  // from a checkpoint need not be constructed like the one written
+
+  template<typename T>
+  struct BinaryCodec<RingBuffer<T>>
+  {
+    static void write(BinaryWriter& writer, const RingBuffer<T>& buffer)
+    {
+      writer.write<uint64_t>(buffer.capacity());
+      writer.write<uint64_t>(buffer.size());
+      for (size_t i = 0; i < buffer.size(); i++)
+        BinaryCodec<T>::write(writer, buffer[i]);
+    }
+
+    static RingBuffer<T> read(BinaryReader& reader)
+    {
+      RingBuffer<T> buffer(reader.read<uint64_t>());
+      size_t size = reader.read<uint64_t>();
+      if (size > buffer.capacity())
+        throw std::runtime_error("Ring buffer holds more values than its capacity");
+      T evicted;
+      for (size_t i = 0; i < size; i++)
+        buffer.push(BinaryCodec<T>::read(reader), evicted);
+      return buffer;
+    }
+  };
+
+  template<typename T>
+  struct BinaryCodec<RollingSum<T>>
+  {
+    static void write(BinaryWriter& writer, const RollingSum<T>& sum)
+    {
+      BinaryCodec<RingBuffer<T>>::write(writer, sum._window);
+      BinaryCodec<T>::write(writer, sum._sum);
+    }
+
+    static RollingSum<T> read(BinaryReader& reader)
+    {
+      RingBuffer<T> window = BinaryCodec<RingBuffer<T>>::read(reader);
+      RollingSum<T> sum(window.capacity());
+      sum._window = std::move(window);
+      sum._sum = BinaryCodec<T>::read(reader);
+      return sum;
+    }
+  };
+
+  template<>
+  struct BinaryCodec<MovingAverage>
+  {
+    static void write(BinaryWriter& writer, const MovingAverage& average)
+    {
+      BinaryCodec<RollingSum<double>>::write(writer, average._sum);
+    }
+
+    static MovingAverage read(BinaryReader& reader)
+    {
+      MovingAverage average(1);
+      average._sum = BinaryCodec<RollingSum<double>>::read(reader);
+      return average;
+    }
+  };
+
+  template<>
+  struct BinaryCodec<Ewma>
+  {
+    static void write(BinaryWriter& writer, const Ewma& ewma)
+    {
+      writer.write(ewma._alpha);
+      writer.write(ewma._average);
+      writer.write(ewma._isEmpty);
+    }
+
+    static Ewma read(BinaryReader& reader)
+    {
+      Ewma ewma(reader.read<double>());
+      ewma._average = reader.read<double>();
+      ewma._isEmpty = reader.read<bool>();
+      return ewma;
+    }
+  };
+
+  template<>
+  struct BinaryCodec<Vwap>
+  {
+    static void write(BinaryWriter& writer, const Vwap& vwap)
+    {
+      BinaryCodec<RingBuffer<Vwap::Sample>>::write(writer, vwap._window);
+      writer.write(vwap._isWindowed);
+      writer.write(vwap._notional);
+      writer.write(vwap._quantity);
+    }
+
+    static Vwap read(BinaryReader& reader)
+    {
+      Vwap vwap;
+      vwap._window = BinaryCodec<RingBuffer<Vwap::Sample>>::read(reader);
+      vwap._isWindowed = reader.read<bool>();
+      vwap._notional = reader.read<double>();
+      vwap._quantity = reader.read<double>();
+      return vwap;
+    }
+  };
+
+  template<typename TTime, typename TDuration>
+  struct BinaryCodec<TimeWindowAverage<TTime, TDuration>>
+  {
+    static void write(BinaryWriter& writer, const TimeWindowAverage<TTime, TDuration>& average)
+    {
+      BinaryCodec<TDuration>::write(writer, average._duration);
+      writer.write<uint64_t>(average._samples.size());
+      for (size_t i = 0; i < average._samples.size(); i++)
+      {
+        BinaryCodec<TTime>::write(writer, average._samples[i].time);
+        writer.write(average._samples[i].value);
+      }
+      writer.write(average._sum);
+    }
+
+    static TimeWindowAverage<TTime, TDuration> read(BinaryReader& reader)
+    {
+      TimeWindowAverage<TTime, TDuration> average(BinaryCodec<TDuration>::read(reader));
+      size_t count = reader.read<uint64_t>();
+      for (size_t i = 0; i < count; i++)
+      {
+        TTime time = BinaryCodec<TTime>::read(reader);
+        average._samples.pushBack({time, reader.read<double>()});
+      }
+      average._sum = reader.read<double>();
+      return average;
+    }
+  };
+}
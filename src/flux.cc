@@ -1,12 +1,70 @@
 #include <flux/flux.hh>
 
+#include <iomanip>
+
 using namespace flux;
 using namespace std;
 
+namespace
+{
+  string formatNanos(uint64_t nanos)
+  {
+    stringstream s;
+    s << setprecision(3);
+    if (nanos < 1000)
+      s << nanos << "ns";
+    else if (nanos < 1000000)
+      s << nanos / 1e3 << "us";
+    else if (nanos < 1000000000)
+      s << nanos / 1e6 << "ms";
+    else
+      s << nanos / 1e9 << "s";
+    return s.str();
+  }
+
+  uint64_t totalNanos(const FieldStats& stats)
+  {
+    return stats.computeNanos.getSum() + stats.publishNanos.getSum();
+  }
+
+  void writeStats(ostream& out, const FieldBase& field, const FieldStats& stats, uint64_t hottestNanos)
+  {
+    // Format into a local stream, so that the precision set here does not leak into the caller's
+    stringstream o;
+    o << " label=\"" << field.getName() << "\\nsets " << stats.setValueCount;
+    if (stats.suppressedCount != 0)
+      o << " (suppressed " << stats.suppressedCount << ")";
+    if (dynamic_cast<const ComputedFieldBase*>(&field) != nullptr)
+    {
+      o << "\\nrecalcs " << stats.recalculateCount << " (aborted " << stats.abortedRecalculateCount << ")";
+      if (stats.computeNanos.getCount() != 0)
+        o << "\\ncompute p50 " << formatNanos(stats.computeNanos.getPercentile(50))
+          << " p99 " << formatNanos(stats.computeNanos.getPercentile(99));
+    }
+    if (stats.fanOut.getCount() != 0)
+      o << "\\nfan-out mean " << setprecision(3) << stats.fanOut.getMean() << " max " << stats.fanOut.getMax();
+    if (stats.publishNanos.getCount() != 0)
+      o << "\\npublish p50 " << formatNanos(stats.publishNanos.getPercentile(50))
+        << " p99 " << formatNanos(stats.publishNanos.getPercentile(99));
+    o << "\"";
+
+    // Hue zero is red, and saturation fades it to white
+    double heat = hottestNanos == 0 ? 0 : double(totalNanos(stats)) / hottestNanos;
+    o << " style=filled fillcolor=\"0.000 " << fixed << setprecision(3) << heat << " 1.000\"";
+    out << o.str();
+  }
+}
+
 void Graph::toDot(std::ostream& o) const
 {
   // TODO plot something to highlight relations
 
+  uint64_t hottestNanos = 0;
+  for (auto const& domain : _domains)
+    for (auto const& field : domain->getFields())
+      if (const FieldStats* stats = field->getStats())
+        hottestNanos = max(hottestNanos, totalNanos(*stats));
+
   o << "digraph {" << endl;
 
   for (auto const& domain : _domains)
@@ -18,8 +76,17 @@ void Graph::toDot(std::ostream& o) const
     for (auto const& field : domain->getFields())
     {
       o << "    \"" << field->getName() << "\"";
-      if (dynamic_cast<ComputedFieldBase*>(field.get()) != nullptr)
-        o << " [shape=box]";
+      bool isComputed = dynamic_cast<ComputedFieldBase*>(field.get()) != nullptr;
+      const FieldStats* stats = field->getStats();
+      if (isComputed || stats != nullptr)
+      {
+        o << " [";
+        if (isComputed)
+          o << "shape=box";
+        if (stats != nullptr)
+          writeStats(o, *field, *stats, hottestNanos);
+        o << "]";
+      }
       o << ";" << endl;
     }
 
@@ -0,0 +1,64 @@
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+
+// Count heap allocations made by the whole test binary, so that tests may assert that a code
+// path does not allocate.
+//
+// Every form of operator new and delete is replaced, so that each allocation is released by the
+// function matching the one that made it. They live in their own translation unit so that they
+// are not inlined into the tests, where GCC would warn that free is called on memory returned by
+// operator new.
+std::atomic<size_t> allocationCount(0);
+
+static void* countedAllocate(size_t size, size_t alignment = 0)
+{
+  allocationCount++;
+  if (size == 0)
+    size = 1;
+  void* memory = alignment <= alignof(std::max_align_t)
+    ? std::malloc(size)
+    : std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+  if (memory)
+    return memory;
+  throw std::bad_alloc();
+}
+
+void* operator new(size_t size) { return countedAllocate(size); }
+void* operator new[](size_t size) { return countedAllocate(size); }
+void* operator new(size_t size, std::align_val_t alignment) { return countedAllocate(size, static_cast<size_t>(alignment)); }
+void* operator new[](size_t size, std::align_val_t alignment) { return countedAllocate(size, static_cast<size_t>(alignment)); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+  try { return countedAllocate(size); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+  try { return countedAllocate(size); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  try { return countedAllocate(size, static_cast<size_t>(alignment)); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+  try { return countedAllocate(size, static_cast<size_t>(alignment)); } catch (const std::bad_alloc&) { return nullptr; }
+}
+
+void operator delete(void* memory) noexcept { std::free(memory); }
+void operator delete[](void* memory) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete[](void* memory, size_t, std::align_val_t) noexcept { std::free(memory); }
+void operator delete(void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete(void* memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
+void operator delete[](void* memory, std::align_val_t, const std::nothrow_t&) noexcept { std::free(memory); }
@@ -0,0 +1,242 @@
+#include <benchmark/benchmark.h>
+
+#include "../flux/flux.hh"
+
+#include <string>
+#include <vector>
+
+using namespace flux;
+using namespace std;
+
+namespace
+{
+  /// A synthetic graph of depth + 1 domains, each relating to the domain before. The first
+  /// domain has keyCount keys, and each later domain has fanOut keys for every key of the domain
+  /// before. A computed field of the last domain multiplies a field of its own by a field of
+  /// the first, so that a change to one key of the first fans out to fanOut^depth rows, found
+  /// across depth relations. With a depth of zero, all fields share a single domain.
+  struct SyntheticGraph
+  {
+    SyntheticGraph(int keyCount, int fanOut, int depth)
+      : graph(),
+        domains(),
+        input(nullptr),
+        weight(nullptr),
+        output(nullptr),
+        keyCount(keyCount),
+        leafCount(keyCount)
+    {
+      for (int level = 0; level <= depth; level++)
+        domains.push_back(&graph.addDomain<int>("level" + std::to_string(level)));
+
+      input = &domains.front()->createField<double>("input");
+      weight = &domains.back()->createField<double>("weight");
+
+      for (int level = 1; level <= depth; level++)
+      {
+        auto& parent = domains[level]->createRelationTo(*domains[level - 1]);
+        leafCount *= fanOut;
+        for (int key = 0; key < leafCount; key++)
+          parent.setValue(key, key / fanOut);
+      }
+
+      output = &domains.back()->compute<double>("output", std::tie(*input, *weight),
+        [](double i, double w) { return i * w; });
+
+      for (int key = 0; key < leafCount; key++)
+        weight->setValue(key, 1.0 + key % 7);
+      setInputs(1.0);
+      graph.compute();
+      graph.publish();
+    }
+
+    void setInputs(double value)
+    {
+      for (int key = 0; key < keyCount; key++)
+        input->setValue(key, value);
+    }
+
+    Graph graph;
+    std::vector<Domain<int>*> domains;
+    Field<double,int>* input;
+    Field<double,int>* weight;
+    ComputedField<double,int>* output;
+    int keyCount;
+    int leafCount;
+  };
+
+  /// Registers the shapes of synthetic graph used by benchmarks taking (keyCount, fanOut, depth)
+  /// arguments: scaling key counts within one domain, then scaling fan-out across one relation,
+  /// then scaling the depth of relation paths.
+  void syntheticShapes(benchmark::internal::Benchmark* benchmark)
+  {
+    benchmark->ArgNames({"keys", "fanOut", "depth"});
+    for (int keyCount = 1000; keyCount <= 1000000; keyCount *= 10)
+      benchmark->Args({keyCount, 1, 0});
+    for (int fanOut = 1; fanOut <= 1000; fanOut *= 10)
+      benchmark->Args({100000 / fanOut, fanOut, 1});
+    for (int depth = 2; depth <= 4; depth++)
+      benchmark->Args({100000 >> (2 * depth), 4, depth});
+  }
+}
+
+/// Sets a field with no dependants or subscribers.
+static void BM_SetValue(benchmark::State& state)
+{
+  Graph graph;
+  auto& domain = graph.addDomain<int>("instrument");
+  auto& px = domain.createField<double>("px");
+  int keyCount = static_cast<int>(state.range(0));
+
+  double value = 0;
+  for (auto _ : state)
+  {
+    value++;
+    for (int key = 0; key < keyCount; key++)
+      px.setValue(key, value);
+  }
+
+  state.SetItemsProcessed(state.iterations() * keyCount);
+}
+BENCHMARK(BM_SetValue)->ArgName("keys")->RangeMultiplier(10)->Range(1000, 1000000);
+
+/// Sets every key of a field with a dependant, which marks the dependant's rows for
+/// recalculation, fanning out across relations to reach them. Computing is not timed.
+static void BM_SetValueWithDependants(benchmark::State& state)
+{
+  SyntheticGraph synthetic(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)), static_cast<int>(state.range(2)));
+
+  double value = 1;
+  for (auto _ : state)
+  {
+    synthetic.setInputs(++value);
+
+    state.PauseTiming();
+    synthetic.graph.compute();
+    state.ResumeTiming();
+  }
+
+  state.SetItemsProcessed(state.iterations() * synthetic.leafCount);
+}
+BENCHMARK(BM_SetValueWithDependants)->Apply(syntheticShapes);
+
+/// Marks every row of a computed field for recalculation and computes them, resolving inputs
+/// within the same domain or across relations.
+static void BM_Recalculate(benchmark::State& state)
+{
+  SyntheticGraph synthetic(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)), static_cast<int>(state.range(2)));
+
+  std::vector<RowId> rows;
+  for (int key = 0; key < synthetic.leafCount; key++)
+    rows.push_back(synthetic.domains.back()->findRow(key));
+
+  for (auto _ : state)
+  {
+    for (RowId row : rows)
+      synthetic.output->recalculate(row);
+    synthetic.graph.compute();
+  }
+
+  state.SetItemsProcessed(state.iterations() * synthetic.leafCount);
+}
+BENCHMARK(BM_Recalculate)->Apply(syntheticShapes);
+
+/// Changes a single key of the first domain and computes, so that only the rows it fans out to
+/// are recalculated.
+static void BM_FanOut(benchmark::State& state)
+{
+  SyntheticGraph synthetic(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)), static_cast<int>(state.range(2)));
+
+  double value = 1;
+  int key = 0;
+  for (auto _ : state)
+  {
+    synthetic.input->setValue(key, ++value);
+    synthetic.graph.compute();
+    key = (key + 1) % synthetic.keyCount;
+  }
+
+  state.SetItemsProcessed(state.iterations() * (synthetic.leafCount / synthetic.keyCount));
+}
+BENCHMARK(BM_FanOut)->Apply(syntheticShapes);
+
+/// A whole cycle: sets every key of the first domain, computes, and publishes the computed
+/// values to a subscriber, using \p computeThreads threads.
+static void BM_ComputeAndPublish(benchmark::State& state)
+{
+  SyntheticGraph synthetic(static_cast<int>(state.range(0)), static_cast<int>(state.range(1)), static_cast<int>(state.range(2)));
+  synthetic.graph.setComputeThreads(static_cast<size_t>(state.range(3)));
+
+  double sum = 0;
+  synthetic.output->subscribe([&](const int&, const double& value) { sum += value; });
+
+  double value = 1;
+  for (auto _ : state)
+  {
+    synthetic.setInputs(++value);
+    synthetic.graph.compute();
+    synthetic.graph.publish();
+  }
+
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * synthetic.leafCount);
+}
+BENCHMARK(BM_ComputeAndPublish)
+  ->ArgNames({"keys", "fanOut", "depth", "threads"})
+  ->Args({100000, 1, 0, 1})
+  ->Args({100000, 1, 0, 4})
+  ->Args({10000, 10, 1, 1})
+  ->Args({10000, 10, 1, 4})
+  ->Args({1000, 10, 2, 1})
+  ->Args({1000, 10, 2, 4});
+
+/// Publishes a change to every key of a field to several subscribers, each receiving a call
+/// per change, or a single call per publish if subscribed in batches. Setting values is not
+/// timed.
+static void BM_SubscriberDispatch(benchmark::State& state)
+{
+  int keyCount = static_cast<int>(state.range(0));
+  int subscriberCount = static_cast<int>(state.range(1));
+  bool isBatch = state.range(2) != 0;
+
+  Graph graph;
+  auto& domain = graph.addDomain<int>("instrument");
+  auto& px = domain.createField<double>("px");
+
+  double sum = 0;
+  for (int i = 0; i < subscriberCount; i++)
+  {
+    if (isBatch)
+    {
+      px.subscribeBatch([&](Span<const TypedFieldBase<double,int>::Change> changes)
+      {
+        for (auto const& change : changes)
+          sum += change.value;
+      });
+    }
+    else
+    {
+      px.subscribe([&](const int&, const double& value) { sum += value; });
+    }
+  }
+
+  double value = 0;
+  for (auto _ : state)
+  {
+    state.PauseTiming();
+    value++;
+    for (int key = 0; key < keyCount; key++)
+      px.setValue(key, value);
+    state.ResumeTiming();
+
+    graph.publish();
+  }
+
+  benchmark::DoNotOptimize(sum);
+  state.SetItemsProcessed(state.iterations() * keyCount * subscriberCount);
+}
+BENCHMARK(BM_SubscriberDispatch)
+  ->ArgNames({"keys", "subscribers", "batch"})
+  ->ArgsProduct({{1000, 100000}, {1, 8}, {0, 1}});
+
+BENCHMARK_MAIN();
@@ -6,10 +6,17 @@
 
 #include <camshaft/uuid.hh>
 
+#include <atomic>
+#include <future>
+
 using namespace flux;
 using namespace rapidjson;
 using namespace std;
 
+// Count of heap allocations made by the whole test binary, maintained by the replacement
+// operator new in allocations.cc, so that tests may assert that a code path does not allocate
+extern std::atomic<size_t> allocationCount;
+
 // Notes
 //
 // - not thread safe
@@ -21,7 +28,6 @@ using namespace std;
 
 // TODO do we need freeze?
 // TODO think about time series
-// TODO think about stateful computations such as moving average
 // TODO think about timing elements such as conflation
 // TODO do we need a timestamp on values?
 // TODO remove field values (i.e. not just additive)
@@ -69,6 +75,47 @@ TEST(FieldTest, setValueRepeatedly)
   EXPECT_EQ(0.3, it1->second);
 }
 
+TEST(FieldTest, iterateValues)
+{
+  Graph graph;
+  auto& domain = graph.addDomain<int>("domain");
+  auto& field1 = domain.createField<double>("field1");
+  auto& field2 = domain.createField<double>("field2");
+
+  // Rows are shared by all fields of the domain, so field1 only holds some of them
+  field2.setValue(30, 3.0);
+  field1.setValue(10, 1.0);
+  field2.setValue(10, 1.5);
+  field1.setValue(20, 2.0);
+  for (int key = 100; key < 300; key++)
+    field2.setValue(key, key);
+
+  EXPECT_EQ(2, field1.count());
+  EXPECT_EQ(202, field2.count());
+
+  // Iteration visits keys in the order they were first seen by the domain
+  vector<pair<int,double>> values;
+  for (auto const& pair : field1)
+    values.emplace_back(pair.first, pair.second);
+  ASSERT_EQ(2, values.size());
+  EXPECT_EQ(make_pair(10, 1.0), values[0]);
+  EXPECT_EQ(make_pair(20, 2.0), values[1]);
+
+  EXPECT_EQ(202, std::distance(field2.begin(), field2.end()));
+  EXPECT_EQ(30, field2.begin()->first);
+  EXPECT_EQ(field1.end(), field1.find(30));
+  EXPECT_EQ(299.0, field2.find(299)->second);
+
+  int visitCount = 0;
+  field1.visit([&](const pair<any,any>& entry)
+  {
+    EXPECT_TRUE(entry.first.is<int>());
+    EXPECT_TRUE(entry.second.is<double>());
+    visitCount++;
+  });
+  EXPECT_EQ(2, visitCount);
+}
+
 TEST(FieldTest, observeField)
 {
   Graph graph;
@@ -447,3 +494,1751 @@ TEST(ComputedFieldTest, computeAcrossMultipleRelations)
   EXPECT_FALSE(graph.isComputeRequired());
   EXPECT_EQ(1, tradeReturnComputeCount);
 }
+
+TEST(DomainTest, rowsAreAssignedOncePerKey)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& lastPx = instrument.createField<double>("lastPx");
+  auto& bidPx = instrument.createField<double>("bidPx");
+
+  EXPECT_FALSE(instrument.findRow(string_view("@VOD")).isValid());
+
+  RowId vod = instrument.getOrAddRow(string_view("@VOD"));
+  RowId bp = instrument.getOrAddRow("@BP");
+
+  EXPECT_EQ(RowId(0), vod);
+  EXPECT_EQ(RowId(1), bp);
+  EXPECT_EQ(vod, instrument.getOrAddRow(string("@VOD")));
+  EXPECT_EQ(bp, instrument.findRow(string_view("@BP.L").substr(0, 3)));
+  EXPECT_EQ("@VOD", instrument.getKey(vod));
+  EXPECT_EQ(2, instrument.getRowCount());
+
+  // Values may be set by key or by row interchangeably
+  lastPx.setValue(vod, 101.0);
+  bidPx.setValue("@VOD", 100.5);
+
+  EXPECT_EQ(101.0, lastPx.getValue(string("@VOD")));
+  EXPECT_EQ(100.5, bidPx.getValue(vod));
+  EXPECT_FALSE(lastPx.hasValue(bp));
+  EXPECT_EQ(lastPx.end(), lastPx.find(bp));
+  EXPECT_THROW(lastPx.getValue(bp), std::runtime_error);
+
+  // Many keys force the dictionary to grow, which must not disturb existing rows
+  for (int i = 0; i < 10000; i++)
+    instrument.getOrAddRow("I" + to_string(i));
+
+  EXPECT_EQ(vod, instrument.findRow(string_view("@VOD")));
+  EXPECT_EQ(RowId(2 + 1234), instrument.findRow("I1234"));
+  EXPECT_EQ(101.0, lastPx.find(string("@VOD"))->second);
+}
+
+TEST(ComputedFieldTest, recomputeAcrossMultipleRelationsWhenRemoteFieldChanges)
+{
+  Graph graph;
+
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& trade = graph.addDomain<int>("trade");
+  auto& currency = graph.addDomain<string>("currency");
+
+  auto& cumQty = trade.createField<unsigned>("cumQty");
+  auto& usdRate = currency.createField<double>("usdRate");
+
+  auto& tradeQaid = trade.createRelationTo(instrument);
+  auto& tradeCcy = instrument.createRelationTo(currency);
+
+  int computeCount = 0;
+  auto& tradeUsdQty = trade.compute<double>(
+    "tradeUsdQty",
+    { &cumQty, &usdRate },
+    [&](const Params& vals)
+    {
+      computeCount++;
+      return vals(cumQty) * vals(usdRate);
+    });
+
+  currency.getOrAddRow("EUR");
+  RowId gbp = currency.getOrAddRow("GBP");
+  RowId vod = instrument.getOrAddRow("@VOD");
+
+  usdRate.setValue(gbp, 2.0);
+  tradeCcy.setRemoteRow(vod, gbp);
+  for (int tradeId = 1; tradeId <= 3; tradeId++)
+  {
+    cumQty.setValue(tradeId, 100 * tradeId);
+    tradeQaid.setValue(tradeId, "@VOD");
+  }
+
+  graph.compute();
+  EXPECT_EQ(3, computeCount);
+  EXPECT_EQ(vod, trade.getRelatedRow(trade.findRow(2), instrument));
+  EXPECT_EQ(gbp, trade.getRelatedRow(trade.findRow(2), currency));
+
+  // A change two relations away fans out to every related trade
+  usdRate.setValue(gbp, 3.0);
+  EXPECT_TRUE(graph.isComputeRequired());
+  graph.compute();
+
+  EXPECT_EQ(6, computeCount);
+  EXPECT_DOUBLE_EQ(300.0, tradeUsdQty.getValue(1));
+  EXPECT_DOUBLE_EQ(900.0, tradeUsdQty.getValue(3));
+}
+
+TEST(ComputedFieldTest, typedComputeAcrossRelation)
+{
+  Graph graph;
+
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& trade = graph.addDomain<Uuid>("trade");
+
+  auto& lastPx = instrument.createField<double>("lastPx");
+  auto& usdRate = instrument.createField<double>("usdRate");
+  auto& cumQty = trade.createField<unsigned>("cumQty");
+  auto& avgPx = trade.createField<double>("avgPx");
+  auto& tradeQaid = trade.createRelationTo(instrument);
+
+  int computeCount = 0;
+  auto& tradeReturn = trade.compute<double>(
+    "tradeReturn",
+    std::tie(cumQty, lastPx, avgPx, usdRate),
+    [&](unsigned qty, double px, double avg, double rate)
+    {
+      computeCount++;
+      return qty * (px - avg) * rate;
+    });
+
+  EXPECT_EQ(4, tradeReturn.getDependencies().size());
+
+  Uuid tradeId = Uuid::random();
+
+  lastPx.setValue("QAID", 101.0);
+  usdRate.setValue("QAID", 2.0);
+  cumQty.setValue(tradeId, 1000);
+  avgPx.setValue(tradeId, 102.0);
+
+  // The relation is not yet known, so nothing can be computed
+  EXPECT_FALSE(graph.isComputeRequired());
+
+  tradeQaid.setValue(tradeId, "QAID");
+
+  EXPECT_TRUE(graph.isComputeRequired());
+  graph.compute();
+
+  EXPECT_EQ(1, computeCount);
+  EXPECT_DOUBLE_EQ(1000 * (101.0 - 102.0) * 2.0, tradeReturn.getValue(tradeId));
+
+  // Changing a value in the related domain recomputes the trade
+  lastPx.setValue("QAID", 103.0);
+  graph.compute();
+
+  EXPECT_EQ(2, computeCount);
+  EXPECT_DOUBLE_EQ(1000 * (103.0 - 102.0) * 2.0, tradeReturn.getValue(tradeId));
+}
+
+TEST(ComputedFieldTest, typedComputeSameDomain)
+{
+  Graph graph;
+  auto& domain = graph.addDomain<int>("domain");
+  auto& price = domain.createField<double>("price");
+  auto& quantity = domain.createField<int>("quantity");
+
+  auto& isLarge = domain.compute<bool>(
+    "isLarge",
+    std::tie(price, quantity),
+    [](const double& px, int qty) { return px * qty > 1000; });
+
+  price.setValue(1, 20.0);
+  quantity.setValue(1, 10);
+  price.setValue(2, 20.0);
+  quantity.setValue(2, 100);
+  price.setValue(3, 20.0);
+
+  graph.compute();
+
+  EXPECT_EQ(2, isLarge.count());
+  EXPECT_FALSE(isLarge.getValue(1));
+  EXPECT_TRUE(isLarge.getValue(2));
+  EXPECT_EQ(isLarge.end(), isLarge.find(3));
+}
+
+TEST(ComputedFieldTest, conflateRecalculationsWithinCycle)
+{
+  Graph graph;
+  auto& domain = graph.addDomain<int>("domain");
+  auto& price = domain.createField<double>("price");
+  auto& quantity = domain.createField<int>("quantity");
+
+  int computeCount = 0;
+  auto& notional = domain.compute<double>(
+    "notional",
+    std::tie(price, quantity),
+    [&](double px, int qty)
+    {
+      computeCount++;
+      return px * qty;
+    });
+
+  int paramsComputeCount = 0;
+  auto& isLarge = domain.compute<bool>(
+    "isLarge",
+    { &notional },
+    [&](const Params& vals)
+    {
+      paramsComputeCount++;
+      return vals(notional) > 1000;
+    });
+
+  quantity.setValue(1, 10);
+  quantity.setValue(2, 20);
+
+  // Many ticks between compute cycles only calculate each key once, with its latest inputs
+  for (int tick = 1; tick <= 50; tick++)
+  {
+    price.setValue(1, tick);
+    price.setValue(2, tick);
+  }
+
+  graph.compute();
+
+  EXPECT_EQ(2, computeCount);
+  EXPECT_DOUBLE_EQ(500.0, notional.getValue(1));
+  EXPECT_DOUBLE_EQ(1000.0, notional.getValue(2));
+
+  // Computed fields that depend upon computed fields are calculated in the same cycle
+  EXPECT_EQ(2, paramsComputeCount);
+  EXPECT_FALSE(isLarge.getValue(1));
+  EXPECT_FALSE(isLarge.getValue(2));
+  EXPECT_FALSE(graph.isComputeRequired());
+
+  price.setValue(2, 51.0);
+  quantity.setValue(2, 21);
+  graph.compute();
+
+  EXPECT_EQ(3, computeCount);
+  EXPECT_EQ(3, paramsComputeCount);
+  EXPECT_TRUE(isLarge.getValue(2));
+}
+
+TEST(FieldTest, conflatePublication)
+{
+  Graph graph;
+  auto& domain = graph.addDomain<int>("domain");
+  auto& field = domain.createField<double>("field");
+
+  vector<pair<int,double>> conflated;
+  vector<pair<int,double>> everyChange;
+
+  field.subscribe([&](int key, double val) { conflated.emplace_back(key, val); });
+  auto unsubscribe = field.subscribe([&](int key, double val) { everyChange.emplace_back(key, val); }, Delivery::EveryChange);
+
+  field.setValue(1, 1.0);
+  field.setValue(2, 2.0);
+  field.setValue(1, 1.1);
+  field.setValue(1, 1.2);
+
+  graph.publish();
+
+  // Conflated subscribers see each changed key once, with its latest value
+  ASSERT_EQ(2, conflated.size());
+  EXPECT_EQ(make_pair(1, 1.2), conflated[0]);
+  EXPECT_EQ(make_pair(2, 2.0), conflated[1]);
+
+  // Other subscribers see every value, in the order it was set
+  ASSERT_EQ(4, everyChange.size());
+  EXPECT_EQ(make_pair(1, 1.0), everyChange[0]);
+  EXPECT_EQ(make_pair(2, 2.0), everyChange[1]);
+  EXPECT_EQ(make_pair(1, 1.1), everyChange[2]);
+  EXPECT_EQ(make_pair(1, 1.2), everyChange[3]);
+  EXPECT_FALSE(graph.isPublishRequired());
+
+  conflated.clear();
+  everyChange.clear();
+  unsubscribe();
+
+  field.setValue(2, 2.1);
+  field.setValue(2, 2.2);
+  graph.publish();
+
+  ASSERT_EQ(1, conflated.size());
+  EXPECT_EQ(make_pair(2, 2.2), conflated[0]);
+  EXPECT_TRUE(everyChange.empty());
+}
+
+TEST(ComputedFieldTest, computeChainsAcrossDomainsInLevelOrder)
+{
+  Graph graph;
+
+  // The trade domain is added first, though its computed fields depend upon the instrument's
+  auto& trade = graph.addDomain<int>("trade");
+  auto& instrument = graph.addDomain<string>("instrument");
+
+  auto& bidPx = instrument.createField<double>("bidPx");
+  auto& askPx = instrument.createField<double>("askPx");
+  auto& usdRate = instrument.createField<double>("usdRate");
+  auto& cumQty = trade.createField<int>("cumQty");
+  auto& tradeQaid = trade.createRelationTo(instrument);
+
+  vector<string> calculations;
+
+  auto& tradeValueUsd = trade.compute<double>("tradeValueUsd", { &cumQty, &usdRate },
+    [&](const Params& vals)
+    {
+      calculations.push_back("tradeValueUsd");
+      return vals(cumQty) * vals(usdRate);
+    });
+
+  auto& midPx = instrument.compute<double>("midPx", std::tie(bidPx, askPx),
+    [&](double bid, double ask)
+    {
+      calculations.push_back("midPx");
+      return (bid + ask) / 2;
+    });
+
+  auto& tradeValue = trade.compute<double>("tradeValue", std::tie(cumQty, midPx),
+    [&](int qty, double mid)
+    {
+      calculations.push_back("tradeValue");
+      return qty * mid;
+    });
+
+  auto& tradeValueRatio = trade.compute<double>("tradeValueRatio", std::tie(tradeValue, tradeValueUsd),
+    [&](double value, double valueUsd)
+    {
+      calculations.push_back("tradeValueRatio");
+      return value / valueUsd;
+    });
+
+  EXPECT_EQ(1, tradeValueUsd.getLevel());
+  EXPECT_EQ(1, midPx.getLevel());
+  EXPECT_EQ(2, tradeValue.getLevel());
+  EXPECT_EQ(3, tradeValueRatio.getLevel());
+
+  cumQty.setValue(1, 100);
+  tradeQaid.setValue(1, "@VOD");
+  usdRate.setValue("@VOD", 2.0);
+  bidPx.setValue("@VOD", 99.0);
+  askPx.setValue("@VOD", 101.0);
+
+  graph.compute();
+
+  // Every field is calculated once, after its inputs, in a single cycle
+  EXPECT_FALSE(graph.isComputeRequired());
+  ASSERT_EQ(4, calculations.size());
+  EXPECT_EQ(1, std::count(calculations.begin(), calculations.end(), "midPx"));
+  EXPECT_EQ(1, std::count(calculations.begin(), calculations.end(), "tradeValueUsd"));
+  EXPECT_EQ("tradeValue", calculations[2]);
+  EXPECT_EQ("tradeValueRatio", calculations[3]);
+  EXPECT_DOUBLE_EQ(10000.0 / 200.0, tradeValueRatio.getValue(1));
+
+  calculations.clear();
+  bidPx.setValue("@VOD", 97.0);
+  usdRate.setValue("@VOD", 4.0);
+  graph.compute();
+
+  ASSERT_EQ(4, calculations.size());
+  EXPECT_EQ("tradeValue", calculations[2]);
+  EXPECT_EQ("tradeValueRatio", calculations[3]);
+  EXPECT_DOUBLE_EQ(9900.0 / 400.0, tradeValueRatio.getValue(1));
+}
+
+TEST(ComputedFieldTest, parallelComputeMatchesSerial)
+{
+  // Builds the same graph twice, computing one serially and the other across several threads
+  struct Model
+  {
+    Graph graph;
+    Domain<int>& trade;
+    Domain<string>& instrument;
+    Field<int,int>& qty;
+    RelationField<int,string>& tradeInstrument;
+    Field<double,string>& px;
+    ComputedField<double,int>& notional;
+    ComputedField<double,int>& half;
+    ComputedField<double,int>& doubled;
+
+    Model()
+      : graph(),
+        trade(graph.addDomain<int>("Trade")),
+        instrument(graph.addDomain<string>("Instrument")),
+        qty(trade.createField<int>("qty")),
+        tradeInstrument(trade.createRelationTo(instrument)),
+        px(instrument.createField<double>("px")),
+        notional(trade.compute<double>("notional", std::tie(qty, px), [](int q, double p) { return q * p; })),
+        half(trade.compute<double>("half", { &qty }, [this](const Params& vals) { return vals(qty) / 2.0; })),
+        doubled(trade.compute<double>("doubled", std::tie(notional, half), [](double n, double h) { return n * 2 + h; }))
+    {}
+  };
+
+  Model serial;
+  Model parallel;
+  parallel.graph.setComputeThreads(4);
+  EXPECT_EQ(4, parallel.graph.getComputeThreads());
+
+  std::vector<int> serialChanges;
+  std::vector<int> parallelChanges;
+  serial.doubled.subscribe([&](int key, double) { serialChanges.push_back(key); }, Delivery::EveryChange);
+  parallel.doubled.subscribe([&](int key, double) { parallelChanges.push_back(key); }, Delivery::EveryChange);
+
+  for (Model* model : { &serial, &parallel })
+  {
+    for (int i = 0; i < 10000; i++)
+    {
+      model->qty.setValue(i, i % 97);
+      model->tradeInstrument.setValue(i, std::to_string(i % 13));
+    }
+    for (int i = 0; i < 13; i++)
+      model->px.setValue(std::to_string(i), 100.0 + i);
+
+    model->graph.compute();
+    model->graph.publish();
+  }
+
+  ASSERT_EQ(10000, parallel.doubled.count());
+  for (int i = 0; i < 10000; i++)
+    ASSERT_DOUBLE_EQ(serial.doubled.getValue(i), parallel.doubled.getValue(i));
+  EXPECT_EQ(serialChanges, parallelChanges);
+
+  // Recalculate a subset of rows
+  for (Model* model : { &serial, &parallel })
+  {
+    model->px.setValue("3", 50.0);
+    model->graph.compute();
+  }
+
+  for (int i = 0; i < 10000; i++)
+    ASSERT_DOUBLE_EQ(serial.doubled.getValue(i), parallel.doubled.getValue(i));
+  EXPECT_DOUBLE_EQ((3 % 97) * 50.0 * 2 + (3 % 97) / 2.0, parallel.doubled.getValue(3));
+}
+
+TEST(ComputedFieldTest, computeBatchAcrossRelation)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("Trade");
+  auto& instrument = graph.addDomain<string>("Instrument");
+
+  auto& qty = trade.createField<int>("qty");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& px = instrument.createField<double>("px");
+
+  std::vector<size_t> batchSizes;
+  auto& notional = trade.computeBatch<double>("notional", std::tie(qty, px),
+    [&](Span<double> out, Span<const int> qtys, Span<const double> pxs)
+    {
+      batchSizes.push_back(out.size());
+      for (size_t i = 0; i < out.size(); i++)
+        out[i] = qtys[i] * pxs[i];
+    });
+
+  // Batch fields may feed scalar ones like any other computed field
+  auto& doubled = trade.compute<double>("doubled", std::tie(notional), [](double n) { return n * 2; });
+  EXPECT_EQ(2, doubled.getLevel());
+
+  std::map<int,double> published;
+  notional.subscribe([&](int key, double val) { published[key] = val; });
+
+  for (int i = 0; i < 600; i++)
+  {
+    qty.setValue(i, i);
+    // Every third trade has no instrument, so cannot be calculated
+    if (i % 3 != 0)
+      tradeInstrument.setValue(i, i % 2 ? "@VOD" : "@BT");
+  }
+  px.setValue("@VOD", 2.0);
+  px.setValue("@BT", 3.0);
+
+  graph.compute();
+  graph.publish();
+
+  EXPECT_EQ(400, notional.count());
+  EXPECT_EQ(400, published.size());
+  EXPECT_FALSE(notional.hasValue(trade.findRow(3)));
+  EXPECT_DOUBLE_EQ(1 * 2.0, notional.getValue(1));
+  EXPECT_DOUBLE_EQ(2 * 3.0, notional.getValue(2));
+  EXPECT_DOUBLE_EQ(599 * 2.0 * 2, doubled.getValue(599));
+
+  // Rows are gathered into batches no larger than the kernel's buffers
+  size_t total = 0;
+  for (size_t size : batchSizes)
+  {
+    EXPECT_LE(size, 256);
+    total += size;
+  }
+  EXPECT_EQ(400, total);
+
+  // Only rows related to the changed instrument are recalculated
+  batchSizes.clear();
+  px.setValue("@BT", 4.0);
+  graph.compute();
+
+  ASSERT_EQ(1, batchSizes.size());
+  EXPECT_EQ(200, batchSizes[0]);
+  EXPECT_DOUBLE_EQ(2 * 4.0, notional.getValue(2));
+  EXPECT_DOUBLE_EQ(1 * 2.0, notional.getValue(1));
+}
+
+TEST(FieldTest, setValuesInBulk)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("Trade");
+  auto& instrument = graph.addDomain<string>("Instrument");
+
+  auto& qty = trade.createField<int>("qty");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& px = instrument.createField<double>("px");
+
+  int calculationCount = 0;
+  auto& notional = trade.compute<double>("notional", std::tie(qty, px),
+    [&](int q, double p) { calculationCount++; return q * p; });
+
+  std::vector<double> everyChange;
+  px.subscribe([&](const string&, double val) { everyChange.push_back(val); }, Delivery::EveryChange);
+
+  std::vector<std::pair<int,int>> quantities;
+  std::vector<int> keys;
+  std::vector<string> instruments;
+  for (int i = 0; i < 1000; i++)
+  {
+    quantities.emplace_back(i, i);
+    keys.push_back(i);
+    instruments.push_back(i % 2 ? "@VOD" : "@BT");
+  }
+
+  qty.setValues(quantities);
+  tradeInstrument.setValues(keys, instruments);
+  px.setValues(std::map<string,double> {{"@VOD", 2.0}, {"@BT", 3.0}});
+
+  EXPECT_EQ(1000, qty.count());
+  EXPECT_EQ(2, instrument.getRowCount());
+
+  graph.compute();
+  graph.publish();
+
+  EXPECT_EQ(1000, calculationCount);
+  EXPECT_DOUBLE_EQ(999 * 2.0, notional.getValue(999));
+  EXPECT_DOUBLE_EQ(998 * 3.0, notional.getValue(998));
+  EXPECT_EQ(2, everyChange.size());
+
+  // Repeated keys within a batch are all stored and observed, but recalculated once
+  calculationCount = 0;
+  everyChange.clear();
+  px.setValues(std::vector<std::pair<string,double>> {{"@VOD", 4.0}, {"@VOD", 5.0}});
+  graph.compute();
+  graph.publish();
+
+  EXPECT_EQ(500, calculationCount);
+  EXPECT_DOUBLE_EQ(999 * 5.0, notional.getValue(999));
+  ASSERT_EQ(2, everyChange.size());
+  EXPECT_DOUBLE_EQ(4.0, everyChange[0]);
+  EXPECT_DOUBLE_EQ(5.0, everyChange[1]);
+}
+
+TEST(FieldTest, enqueueFromManyThreads)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("Instrument");
+  auto& px = instrument.createField<double>("px");
+  auto& size = instrument.createField<int>("size");
+
+  int calculationCount = 0;
+  auto& value = instrument.compute<double>("value", std::tie(px, size),
+    [&](double p, int s) { calculationCount++; return p * s; });
+
+  std::vector<std::pair<string,double>> changes;
+  px.subscribe([&](const string& key, double val) { changes.emplace_back(key, val); }, Delivery::EveryChange);
+
+  // Each thread updates its own instrument many times, so only the last value of each remains
+  const int threadCount = 4;
+  const int updateCount = 10000;
+  std::vector<std::thread> threads;
+  for (int t = 0; t < threadCount; t++)
+  {
+    threads.emplace_back([&,t]
+    {
+      string key = "@" + std::to_string(t);
+      graph.enqueue(size, key, t);
+      for (int i = 1; i <= updateCount; i++)
+        graph.enqueue(px, key, double(i));
+    });
+  }
+  for (auto& thread : threads)
+    thread.join();
+
+  // Nothing is applied until compute
+  EXPECT_EQ(0, px.count());
+
+  graph.compute();
+  graph.publish();
+
+  EXPECT_EQ(threadCount, calculationCount);
+  ASSERT_EQ(threadCount, changes.size());
+  for (int t = 0; t < threadCount; t++)
+  {
+    string key = "@" + std::to_string(t);
+    EXPECT_DOUBLE_EQ(updateCount, px.getValue(key));
+    EXPECT_DOUBLE_EQ(double(updateCount) * t, value.getValue(key));
+  }
+
+  // Updates to different keys are applied in the order they were queued
+  changes.clear();
+  graph.enqueue(px, "@1", 1.0);
+  graph.enqueue(px, "@0", 2.0);
+  graph.enqueue(px, "@1", 3.0);
+  graph.compute();
+  graph.publish();
+
+  ASSERT_EQ(2, changes.size());
+  EXPECT_EQ(make_pair(string("@0"), 2.0), changes[0]);
+  EXPECT_EQ(make_pair(string("@1"), 3.0), changes[1]);
+
+  // Keys first seen in the queue are assigned rows in the order they were queued
+  graph.enqueue(px, "@5", 1.0);
+  graph.enqueue(px, "@6", 2.0);
+  graph.compute();
+
+  EXPECT_EQ("@5", instrument.getKey(RowId(threadCount)));
+  EXPECT_EQ("@6", instrument.getKey(RowId(threadCount + 1)));
+}
+
+TEST(ComputedFieldTest, repointRelation)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("Trade");
+  auto& instrument = graph.addDomain<string>("Instrument");
+
+  auto& qty = trade.createField<int>("qty");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& px = instrument.createField<double>("px");
+
+  std::vector<int> calculated;
+  auto& notional = trade.compute<double>("notional", std::tie(qty, px),
+    [&](int q, double p) { calculated.push_back(q); return q * p; });
+
+  px.setValue("@VOD", 2.0);
+  px.setValue("@BT", 3.0);
+  for (int i = 0; i < 100; i++)
+  {
+    qty.setValue(i, i);
+    tradeInstrument.setValue(i, "@VOD");
+  }
+  graph.compute();
+
+  // Move every other trade, one at a time, to another instrument
+  for (int i = 0; i < 100; i += 2)
+    tradeInstrument.setValue(i, "@BT");
+  graph.compute();
+
+  EXPECT_EQ(50, tradeInstrument.getLocalRows(instrument.findRow("@VOD")).size());
+  EXPECT_EQ(50, tradeInstrument.getLocalRows(instrument.findRow("@BT")).size());
+  EXPECT_DOUBLE_EQ(2 * 3.0, notional.getValue(2));
+
+  // Trades that moved away are not recalculated when their former instrument changes
+  calculated.clear();
+  px.setValue("@VOD", 4.0);
+  graph.compute();
+
+  ASSERT_EQ(50, calculated.size());
+  for (int q : calculated)
+    EXPECT_EQ(1, q % 2);
+  EXPECT_DOUBLE_EQ(1 * 4.0, notional.getValue(1));
+  EXPECT_DOUBLE_EQ(2 * 3.0, notional.getValue(2));
+
+  // Setting the same instrument again leaves the index unchanged
+  tradeInstrument.setValue(1, "@VOD");
+  EXPECT_EQ(50, tradeInstrument.getLocalRows(instrument.findRow("@VOD")).size());
+
+  std::vector<any> keys = tradeInstrument.getKeys(any(string("@BT")));
+  EXPECT_EQ(50, keys.size());
+}
+
+TEST(ComputedFieldTest, repointRelationAlongMultiStepPath)
+{
+  Graph graph;
+
+  auto& trade = graph.addDomain<int>("trade");
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& currency = graph.addDomain<string>("currency");
+
+  auto& cumQty = trade.createField<unsigned>("cumQty");
+  auto& usdRate = currency.createField<double>("usdRate");
+
+  auto& tradeQaid = trade.createRelationTo(instrument);
+  auto& instrumentCcy = instrument.createRelationTo(currency);
+
+  // Relations set before the computed field exists are indexed when it is created
+  instrumentCcy.setValue("@VOD", "GBP");
+  instrumentCcy.setValue("@SAP", "EUR");
+  for (int tradeId = 0; tradeId < 10; tradeId++)
+    tradeQaid.setValue(tradeId, tradeId % 2 ? "@VOD" : "@SAP");
+
+  std::vector<int> calculated;
+  auto& tradeUsdQty = trade.compute<double>("tradeUsdQty", std::tie(cumQty, usdRate),
+    [&](unsigned qty, double rate)
+    {
+      calculated.push_back(qty);
+      return qty * rate;
+    });
+
+  usdRate.setValue("GBP", 2.0);
+  usdRate.setValue("EUR", 1.5);
+  for (int tradeId = 0; tradeId < 10; tradeId++)
+    cumQty.setValue(tradeId, tradeId);
+  graph.compute();
+
+  const RelationPathIndex& pathIndex = trade.getRelationPathIndex(currency);
+  EXPECT_EQ(5, pathIndex.getLocalRows(currency.findRow("GBP")).size());
+  EXPECT_EQ(5, pathIndex.getLocalRows(currency.findRow("EUR")).size());
+
+  // Moving an instrument to another currency moves all of its trades, recalculating only them
+  calculated.clear();
+  instrumentCcy.setValue("@SAP", "GBP");
+  graph.compute();
+
+  EXPECT_EQ(10, pathIndex.getLocalRows(currency.findRow("GBP")).size());
+  EXPECT_EQ(0, pathIndex.getLocalRows(currency.findRow("EUR")).size());
+  EXPECT_EQ(5, calculated.size());
+  EXPECT_DOUBLE_EQ(4 * 2.0, tradeUsdQty.getValue(4));
+
+  // Moving a trade to another instrument moves it along the whole path
+  tradeQaid.setValue(1, "@SAP");
+  instrumentCcy.setValue("@SAP", "EUR");
+  graph.compute();
+
+  EXPECT_EQ(4, pathIndex.getLocalRows(currency.findRow("GBP")).size());
+  auto eurTrades = pathIndex.getLocalRows(currency.findRow("EUR"));
+  EXPECT_EQ(6, eurTrades.size());
+  EXPECT_NE(eurTrades.end(), std::find(eurTrades.begin(), eurTrades.end(), trade.findRow(1)));
+
+  // Trades that moved away are not recalculated when their former currency changes
+  calculated.clear();
+  usdRate.setValue("GBP", 3.0);
+  graph.compute();
+
+  EXPECT_EQ(4, calculated.size());
+  EXPECT_DOUBLE_EQ(1 * 1.5, tradeUsdQty.getValue(1));
+  EXPECT_DOUBLE_EQ(3 * 3.0, tradeUsdQty.getValue(3));
+}
+
+TEST(ComputedFieldTest, resolvedRowsFollowRelationChanges)
+{
+  Graph graph;
+
+  auto& trade = graph.addDomain<int>("trade");
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& currency = graph.addDomain<string>("currency");
+
+  auto& cumQty = trade.createField<unsigned>("cumQty");
+  auto& usdRate = currency.createField<double>("usdRate");
+  auto& tradeQaid = trade.createRelationTo(instrument);
+  auto& instrumentCcy = instrument.createRelationTo(currency);
+
+  auto& tradeUsdQty = trade.compute<double>("tradeUsdQty", { &cumQty, &usdRate },
+    [&](const Params& vals) { return vals(cumQty) * vals(usdRate); });
+
+  usdRate.setValue("GBP", 2.0);
+  usdRate.setValue("EUR", 1.5);
+  cumQty.setValue(1, 100);
+
+  // Without a path to a currency the trade cannot be calculated
+  tradeQaid.setValue(1, "@VOD");
+  graph.compute();
+  EXPECT_EQ(0, tradeUsdQty.count());
+
+  instrumentCcy.setValue("@VOD", "GBP");
+  graph.compute();
+  EXPECT_DOUBLE_EQ(200.0, tradeUsdQty.getValue(1));
+
+  // Each relation along the path is followed afresh when it changes
+  instrumentCcy.setValue("@VOD", "EUR");
+  graph.compute();
+  EXPECT_DOUBLE_EQ(150.0, tradeUsdQty.getValue(1));
+
+  instrumentCcy.setValue("@SAP", "GBP");
+  tradeQaid.setValue(1, "@SAP");
+  graph.compute();
+  EXPECT_DOUBLE_EQ(200.0, tradeUsdQty.getValue(1));
+}
+
+TEST(DomainTest, steadyStateCyclesDoNotAllocate)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("Trade");
+  auto& instrument = graph.addDomain<string>("Instrument");
+
+  auto& qty = trade.createField<int>("qty");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& px = instrument.createField<double>("px");
+
+  auto& notional = trade.compute<double>("notional", std::tie(qty, px), [](int q, double p) { return q * p; });
+
+  double notionalSum = 0;
+  size_t pxChangeCount = 0;
+  notional.subscribe([&](int, double val) { notionalSum += val; });
+  px.subscribe([&](const string&, double) { pxChangeCount++; }, Delivery::EveryChange);
+
+  std::vector<string> instruments {"@VOD", "@BT", "@SAP"};
+  for (int i = 0; i < 100; i++)
+  {
+    qty.setValue(i, i);
+    tradeInstrument.setValue(i, instruments[i % instruments.size()]);
+  }
+
+  size_t taskCount = 0;
+  auto cycle = [&](int tick)
+  {
+    for (auto const& key : instruments)
+      px.setValue(key, 100.0 + tick);
+    qty.setValue(tick % 100, tick);
+
+    // Tasks capturing more than fits within a std::function's small buffer
+    std::array<double,8> captured {};
+    captured[0] = tick;
+    trade.addComputeTask([&taskCount,captured] { taskCount += captured[0] >= 0 ? 1 : 0; });
+    instrument.addPublishTask([&taskCount,captured] { taskCount += captured[0] >= 0 ? 1 : 0; });
+
+    graph.compute();
+    graph.publish();
+  };
+
+  // Allow buffers to reach their working size
+  for (int tick = 0; tick < 10; tick++)
+    cycle(tick);
+
+  size_t allocationsBefore = allocationCount;
+  for (int tick = 10; tick < 1000; tick++)
+    cycle(tick);
+
+  EXPECT_EQ(allocationsBefore, allocationCount);
+  EXPECT_EQ(2000, taskCount);
+  EXPECT_EQ(3000, pxChangeCount);
+  EXPECT_DOUBLE_EQ(999 * 1099.0, notional.getValue(99));
+}
+
+TEST(FieldTest, subscribeBatch)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("Instrument");
+  auto& px = instrument.createField<double>("px");
+
+  typedef TypedFieldBase<double,string>::Change Change;
+
+  std::vector<std::vector<std::pair<string,double>>> conflated;
+  std::vector<std::vector<std::pair<string,double>>> everyChange;
+  std::vector<size_t> boxedSizes;
+
+  px.subscribeBatch([&](Span<const Change> changes)
+  {
+    conflated.emplace_back();
+    for (auto const& change : changes)
+      conflated.back().emplace_back(change.key, change.value);
+  });
+  px.subscribeBatch([&](Span<const Change> changes)
+  {
+    everyChange.emplace_back();
+    for (auto const& change : changes)
+      everyChange.back().emplace_back(change.key, change.value);
+  }, Delivery::EveryChange);
+
+  FieldBase& untyped = px;
+  auto unsubscribe = untyped.subscribeBatch([&](Span<const std::pair<any,any>> changes)
+  {
+    boxedSizes.push_back(changes.size());
+    EXPECT_DOUBLE_EQ(3.0, any_cast<double>(changes[0].second));
+  });
+
+  px.setValue("@VOD", 1.0);
+  px.setValue("@BT", 2.0);
+  px.setValue("@VOD", 3.0);
+  graph.publish();
+
+  // One call per subscription per publish
+  ASSERT_EQ(1, conflated.size());
+  EXPECT_EQ((std::vector<std::pair<string,double>> {{"@VOD", 3.0}, {"@BT", 2.0}}), conflated[0]);
+  ASSERT_EQ(1, everyChange.size());
+  EXPECT_EQ((std::vector<std::pair<string,double>> {{"@VOD", 1.0}, {"@BT", 2.0}, {"@VOD", 3.0}}), everyChange[0]);
+  EXPECT_EQ(std::vector<size_t> {2}, boxedSizes);
+
+  // Nothing is delivered when nothing changed
+  graph.publish();
+  EXPECT_EQ(1, conflated.size());
+
+  unsubscribe();
+  px.setValue("@BT", 4.0);
+  graph.publish();
+  EXPECT_EQ(2, conflated.size());
+  EXPECT_EQ(1, boxedSizes.size());
+}
+
+TEST(FieldTest, subscribeToKeys)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("Instrument");
+  auto& px = instrument.createField<double>("px");
+
+  std::vector<std::pair<string,double>> vodBt;
+  std::vector<std::pair<string,double>> sapEveryChange;
+  auto unsubscribe = px.subscribe({"@VOD", "@BT"}, [&](const string& key, double val) { vodBt.emplace_back(key, val); });
+  px.subscribe({"@SAP"}, [&](const string& key, double val) { sapEveryChange.emplace_back(key, val); }, Delivery::EveryChange);
+
+  // Subscribing does not add keys to the domain
+  EXPECT_EQ(0, instrument.getRowCount());
+
+  px.setValue("@VOD", 1.0);
+  px.setValue("@SAP", 2.0);
+  px.setValue("@SAP", 3.0);
+  px.setValue("@MSFT", 4.0);
+  graph.publish();
+
+  EXPECT_EQ((std::vector<std::pair<string,double>> {{"@VOD", 1.0}}), vodBt);
+  EXPECT_EQ((std::vector<std::pair<string,double>> {{"@SAP", 2.0}, {"@SAP", 3.0}}), sapEveryChange);
+
+  // Changes to keys nobody observes are not queued for publication
+  px.setValue("@MSFT", 5.0);
+  EXPECT_FALSE(graph.isPublishRequired());
+
+  // A key first seen by another field is bound when this field changes it
+  std::vector<std::pair<string,double>> ibm;
+  auto& bid = instrument.createField<double>("bid");
+  px.subscribe({"@IBM"}, [&](const string& key, double val) { ibm.emplace_back(key, val); });
+  bid.setValue("@IBM", 8.0);
+  px.setValue("@IBM", 9.0);
+  graph.publish();
+  EXPECT_EQ((std::vector<std::pair<string,double>> {{"@IBM", 9.0}}), ibm);
+  EXPECT_EQ(4, instrument.getRowCount());
+
+  unsubscribe();
+  vodBt.clear();
+  px.setValue("@VOD", 6.0);
+  px.setValue("@BT", 7.0);
+  EXPECT_FALSE(graph.isPublishRequired());
+  graph.publish();
+  EXPECT_TRUE(vodBt.empty());
+}
+
+TEST(FieldTest, publishOnThread)
+{
+  for (BackPressure backPressure : { BackPressure::Conflate, BackPressure::Bounded })
+  {
+    Graph graph;
+    auto& instrument = graph.addDomain<string>("Instrument");
+    auto& px = instrument.createField<double>("px");
+
+    // The first delivery blocks until released, as a slow subscriber would
+    std::promise<void> release;
+    std::shared_future<void> released = release.get_future().share();
+    std::atomic<bool> isBlocked(false);
+
+    std::vector<std::pair<string,double>> conflated;
+    std::vector<std::pair<string,double>> everyChange;
+    px.subscribe([&](const string& key, double val)
+    {
+      if (!isBlocked.exchange(true))
+        released.wait();
+      conflated.emplace_back(key, val);
+    });
+    px.subscribe([&](const string& key, double val) { everyChange.emplace_back(key, val); }, Delivery::EveryChange);
+
+    graph.startPublishThread(backPressure, 2);
+
+    px.setValue("@VOD", 1.0);
+    graph.publish();
+    while (!isBlocked)
+      std::this_thread::yield();
+
+    // Publishing does not wait while the subscriber is blocked
+    px.setValue("@VOD", 2.0);
+    px.setValue("@VOD", 3.0);
+    graph.publish();
+    px.setValue("@BT", 4.0);
+    px.setValue("@VOD", 5.0);
+    graph.publish();
+
+    release.set_value();
+    graph.flushPublish();
+
+    EXPECT_EQ((std::vector<std::pair<string,double>> {{"@VOD", 1.0}, {"@VOD", 5.0}, {"@BT", 4.0}}), conflated);
+
+    if (backPressure == BackPressure::Conflate)
+    {
+      // Once behind, changes replace those to the same key still awaiting delivery
+      EXPECT_EQ((std::vector<std::pair<string,double>> {{"@VOD", 1.0}, {"@VOD", 2.0}, {"@VOD", 5.0}, {"@BT", 4.0}}), everyChange);
+      EXPECT_EQ(0, graph.getDroppedChangeCount());
+    }
+    else
+    {
+      // Once behind, changes beyond the limit are dropped
+      EXPECT_EQ((std::vector<std::pair<string,double>> {{"@VOD", 1.0}, {"@VOD", 2.0}, {"@VOD", 3.0}}), everyChange);
+      EXPECT_EQ(2, graph.getDroppedChangeCount());
+    }
+
+    // Publishing is synchronous once the thread stops
+    graph.stopPublishThread();
+    px.setValue("@BT", 6.0);
+    graph.publish();
+    EXPECT_EQ(make_pair(string("@BT"), 6.0), conflated.back());
+  }
+}
+
+TEST(FieldTest, unsubscribeWhilePublishingOnThread)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("Instrument");
+  auto& px = instrument.createField<double>("px");
+
+  // Subscribers cancel themselves from within their callbacks on the publisher thread, while
+  // the graph thread continues to record and publish changes
+  int allCount = 0;
+  std::function<void()> unsubscribeAll;
+  unsubscribeAll = px.subscribe([&](const string&, double)
+  {
+    if (++allCount == 10)
+      unsubscribeAll();
+  }, Delivery::EveryChange);
+
+  int keyedCount = 0;
+  std::function<void()> unsubscribeKeyed;
+  unsubscribeKeyed = px.subscribe({"@K5", "@K7"}, [&](const string&, double)
+  {
+    if (++keyedCount == 3)
+      unsubscribeKeyed();
+  }, Delivery::EveryChange);
+
+  std::atomic<int> totalCount(0);
+  px.subscribe([&](const string&, double) { totalCount++; }, Delivery::EveryChange);
+
+  graph.startPublishThread(BackPressure::Bounded, 1000);
+  for (int i = 0; i < 1000; i++)
+  {
+    px.setValue("@K" + std::to_string(i % 10), i);
+    graph.publish();
+  }
+  graph.flushPublish();
+  graph.stopPublishThread();
+
+  EXPECT_EQ(10, allCount);
+  EXPECT_EQ(3, keyedCount);
+  EXPECT_EQ(1000 - static_cast<int>(graph.getDroppedChangeCount()), totalCount);
+}
+
+TEST(DomainTest, readSnapshotsWhileComputing)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("Instrument");
+  auto& px = instrument.createField<double>("px");
+  auto& value = instrument.compute<double>("value", std::tie(px), [](double p) { return p * 2; });
+
+  px.setValue("@VOD", 1.0);
+  graph.compute();
+  graph.enableSnapshots();
+
+  SnapshotReader reader = graph.createSnapshotReader();
+  {
+    auto first = reader.pin();
+    ASSERT_TRUE(first);
+    EXPECT_EQ(1, first->getVersion());
+
+    // A pinned snapshot is unaffected by later computes
+    px.setValue("@VOD", 3.0);
+    px.setValue("@BT", 4.0);
+    graph.compute();
+
+    EXPECT_DOUBLE_EQ(2.0, first->getValue(value, "@VOD"));
+    EXPECT_EQ(nullptr, first->find(px, "@BT"));
+    EXPECT_EQ(1, first->count(px));
+  }
+  {
+    auto second = reader.pin();
+    EXPECT_EQ(2, second->getVersion());
+    EXPECT_DOUBLE_EQ(6.0, second->getValue(value, "@VOD"));
+    EXPECT_DOUBLE_EQ(8.0, *second->find(value, string("@BT")));
+    EXPECT_EQ(2, second->count(value));
+    EXPECT_THROW(second->getValue(px, "@LLOY"), std::runtime_error);
+  }
+
+  // Read snapshots on another thread while many keys are added and changed
+  const int keyCount = 2000;
+  const int cycleCount = 100;
+  std::atomic<bool> isDone(false);
+  std::atomic<int> inconsistentCount(0);
+  std::thread readerThread([&]
+  {
+    SnapshotReader threadReader = graph.createSnapshotReader();
+    uint64_t version = 0;
+    while (!isDone)
+    {
+      auto snapshot = threadReader.pin();
+      if (snapshot->getVersion() < version)
+        inconsistentCount++;
+      version = snapshot->getVersion();
+
+      // Each computed value matches the input it was calculated from
+      for (int k = 0; k < keyCount; k += 37)
+      {
+        string key = "@" + std::to_string(k);
+        const double* p = snapshot->find(px, key);
+        const double* v = snapshot->find(value, key);
+        if ((p == nullptr) != (v == nullptr) || (p != nullptr && *v != *p * 2))
+          inconsistentCount++;
+      }
+    }
+  });
+
+  for (int cycle = 0; cycle < cycleCount; cycle++)
+  {
+    for (int k = 0; k < keyCount * (cycle + 1) / cycleCount; k += 1 + cycle % 7)
+      px.setValue("@" + std::to_string(k), double(cycle));
+    graph.compute();
+  }
+
+  isDone = true;
+  readerThread.join();
+
+  EXPECT_EQ(0, inconsistentCount);
+  auto last = reader.pin();
+  EXPECT_EQ(cycleCount + 2, last->getVersion());
+  EXPECT_EQ(px.count(), last->count(px));
+  for (auto const& pair : value)
+    EXPECT_DOUBLE_EQ(pair.second, last->getValue(value, pair.first));
+}
+
+TEST(DomainTest, snapshotVersionsAreReclaimedOnceReleased)
+{
+  struct Tracked
+  {
+    explicit Tracked(int& liveCount) : liveCount(liveCount) { liveCount++; }
+    ~Tracked() { liveCount--; }
+    int& liveCount;
+  };
+
+  int liveCount = 0;
+  {
+    Versioned<Tracked> versioned;
+    auto reader = versioned.addReader();
+    EXPECT_EQ(nullptr, reader.pin().get());
+
+    versioned.publish(std::make_unique<Tracked>(liveCount));
+    auto pin = reader.pin();
+    const Tracked* first = pin.get();
+
+    // Replaced versions are retained while a reader may hold them
+    versioned.publish(std::make_unique<Tracked>(liveCount));
+    versioned.publish(std::make_unique<Tracked>(liveCount));
+    EXPECT_EQ(3, liveCount);
+    EXPECT_EQ(2, versioned.getRetiredCount());
+    EXPECT_EQ(first, pin.get());
+
+    // And freed by the next publish once released
+    pin.release();
+    versioned.publish(std::make_unique<Tracked>(liveCount));
+    EXPECT_EQ(1, liveCount);
+    EXPECT_EQ(0, versioned.getRetiredCount());
+
+    // Readers not holding a pin do not delay reclamation
+    auto other = versioned.addReader();
+    versioned.publish(std::make_unique<Tracked>(liveCount));
+    EXPECT_EQ(1, liveCount);
+  }
+  EXPECT_EQ(0, liveCount);
+}
+
+TEST(DomainTest, checkpointAndRestore)
+{
+  // Both graphs are built by the same code, as an application restarting would
+  struct Model
+  {
+    explicit Model(Graph& graph)
+      : trade(graph.addDomain<int>("trade")),
+        instrument(graph.addDomain<string>("instrument")),
+        currency(graph.addDomain<string>("currency")),
+        cumQty(trade.createField<unsigned>("cumQty")),
+        name(instrument.createField<string>("name")),
+        usdRate(currency.createField<double>("usdRate")),
+        tradeQaid(trade.createRelationTo(instrument)),
+        instrumentCcy(instrument.createRelationTo(currency)),
+        calculationCount(0),
+        tradeUsdQty(trade.compute<double>("tradeUsdQty", std::tie(cumQty, usdRate),
+          [this](unsigned qty, double rate) { calculationCount++; return qty * rate; }))
+    {}
+
+    Domain<int>& trade;
+    Domain<string>& instrument;
+    Domain<string>& currency;
+    Field<unsigned,int>& cumQty;
+    Field<string,string>& name;
+    Field<double,string>& usdRate;
+    RelationField<int,string>& tradeQaid;
+    RelationField<string,string>& instrumentCcy;
+    int calculationCount;
+    ComputedField<double,int>& tradeUsdQty;
+  };
+
+  Graph graph;
+  Model model(graph);
+  model.instrumentCcy.setValue("@VOD", "GBP");
+  model.instrumentCcy.setValue("@SAP", "EUR");
+  model.name.setValue("@VOD", "Vodafone");
+  model.usdRate.setValue("GBP", 2.0);
+  model.usdRate.setValue("EUR", 1.5);
+  for (int tradeId = 0; tradeId < 100; tradeId++)
+  {
+    model.tradeQaid.setValue(tradeId, tradeId % 2 ? "@VOD" : "@SAP");
+    model.cumQty.setValue(tradeId, tradeId);
+  }
+
+  // Checkpoints are only written once computed values are up to date
+  std::ostringstream stale;
+  EXPECT_THROW(graph.writeCheckpoint(stale), std::runtime_error);
+  graph.compute();
+
+  std::ostringstream out;
+  graph.writeCheckpoint(out);
+  string checkpoint = out.str();
+
+  Graph restored;
+  Model restoredModel(restored);
+  int observedCount = 0;
+  restoredModel.tradeUsdQty.subscribe([&](int, double) { observedCount++; });
+  restored.readCheckpoint(checkpoint.data(), checkpoint.size());
+
+  // Keys keep their rows, and computed values are read rather than recalculated
+  EXPECT_FALSE(restored.isComputeRequired());
+  EXPECT_FALSE(restored.isPublishRequired());
+  EXPECT_EQ(0, restoredModel.calculationCount);
+  EXPECT_EQ(0, observedCount);
+  EXPECT_EQ(model.trade.findRow(57), restoredModel.trade.findRow(57));
+  EXPECT_EQ("Vodafone", restoredModel.name.getValue(string("@VOD")));
+  EXPECT_EQ("@VOD", restoredModel.tradeQaid.getValue(57));
+  ASSERT_EQ(100, restoredModel.tradeUsdQty.count());
+  for (int tradeId = 0; tradeId < 100; tradeId++)
+    EXPECT_DOUBLE_EQ(model.tradeUsdQty.getValue(tradeId), restoredModel.tradeUsdQty.getValue(tradeId));
+
+  // Relation indexes are restored, so changes propagate to the same rows as before
+  const RelationPathIndex& pathIndex = restoredModel.trade.getRelationPathIndex(restoredModel.currency);
+  EXPECT_EQ(50, pathIndex.getLocalRows(restoredModel.currency.findRow("GBP")).size());
+  restoredModel.usdRate.setValue("GBP", 3.0);
+  restoredModel.instrumentCcy.setValue("@SAP", "GBP");
+  restoredModel.tradeQaid.setValue(2, "@VOD");
+  restored.compute();
+  EXPECT_EQ(100, restoredModel.calculationCount);
+  EXPECT_EQ(100, pathIndex.getLocalRows(restoredModel.currency.findRow("GBP")).size());
+  EXPECT_EQ(49, restoredModel.tradeQaid.getLocalRows(restoredModel.instrument.findRow("@SAP")).size());
+  EXPECT_DOUBLE_EQ(4 * 3.0, restoredModel.tradeUsdQty.getValue(4));
+
+  // Checkpoints may be saved to and memory mapped from a file
+  string path = "flux_test_checkpoint";
+  graph.saveCheckpoint(path);
+  Graph mapped;
+  Model mappedModel(mapped);
+  mapped.loadCheckpoint(path);
+  std::remove(path.c_str());
+  EXPECT_DOUBLE_EQ(99 * 2.0, mappedModel.tradeUsdQty.getValue(99));
+
+  // A graph of a different shape is detected
+  Graph other;
+  auto& trade = other.addDomain<int>("trade");
+  other.addDomain<string>("instrument");
+  other.addDomain<string>("currency");
+  trade.createField<double>("cumQty");
+  EXPECT_THROW(other.readCheckpoint(checkpoint.data(), checkpoint.size()), std::runtime_error);
+
+  // As is one that has already assigned keys
+  Graph used;
+  Model usedModel(used);
+  usedModel.usdRate.setValue("JPY", 0.01);
+  EXPECT_THROW(used.readCheckpoint(checkpoint.data(), checkpoint.size()), std::runtime_error);
+}
+
+TEST(DomainTest, journalAndReplay)
+{
+  struct Model
+  {
+    explicit Model(Graph& graph)
+      : trade(graph.addDomain<int>("trade")),
+        instrument(graph.addDomain<string>("instrument")),
+        cumQty(trade.createField<unsigned>("cumQty")),
+        px(instrument.createField<double>("px")),
+        name(instrument.createField<string>("name")),
+        tradeQaid(trade.createRelationTo(instrument)),
+        notional(trade.compute<double>("notional", std::tie(cumQty, px),
+          [](unsigned qty, double p) { return qty * p; }))
+    {}
+
+    Domain<int>& trade;
+    Domain<string>& instrument;
+    Field<unsigned,int>& cumQty;
+    Field<double,string>& px;
+    Field<string,string>& name;
+    RelationField<int,string>& tradeQaid;
+    ComputedField<double,int>& notional;
+  };
+
+  string path = "flux_test_journal";
+
+  Graph graph;
+  Model model(graph);
+  graph.startJournal(path);
+
+  // Values set directly, in bulk and via enqueue are all recorded, one frame per cycle
+  model.px.setValues(std::vector<std::pair<string,double>> {{"@VOD", 1.5}, {"@SAP", 2.0}});
+  model.name.setValue("@VOD", "Vodafone");
+  for (int tradeId = 0; tradeId < 10; tradeId++)
+  {
+    model.tradeQaid.setValue(tradeId, tradeId % 2 ? "@VOD" : "@SAP");
+    model.cumQty.setValue(tradeId, 100 + tradeId);
+  }
+  graph.compute();
+
+  graph.enqueue(model.px, string("@VOD"), 1.75);
+  model.tradeQaid.setValue(4, "@VOD");
+  graph.compute();
+
+  // Cycles with nothing to record are skipped
+  graph.compute();
+
+  // Values stored since the last compute are recorded when the journal stops
+  model.cumQty.setValue(9, 1000);
+  graph.stopJournal();
+  graph.compute();
+
+  Graph replayed;
+  Model replayedModel(replayed);
+  EXPECT_EQ(3, replayed.replayJournal(path));
+
+  EXPECT_EQ("Vodafone", replayedModel.name.getValue(string("@VOD")));
+  EXPECT_EQ("@VOD", replayedModel.tradeQaid.getValue(4));
+  ASSERT_EQ(10, replayedModel.notional.count());
+  for (int tradeId = 0; tradeId < 10; tradeId++)
+    EXPECT_DOUBLE_EQ(model.notional.getValue(tradeId), replayedModel.notional.getValue(tradeId));
+  EXPECT_DOUBLE_EQ(1000 * 1.75, replayedModel.notional.getValue(9));
+
+  // A final frame cut short by a crash is ignored
+  {
+    std::ifstream in(path, std::ios::binary);
+    string journal((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(journal.data(), journal.size() - 3);
+  }
+  Graph truncated;
+  Model truncatedModel(truncated);
+  EXPECT_EQ(2, truncated.replayJournal(path));
+  EXPECT_DOUBLE_EQ(109 * 1.75, truncatedModel.notional.getValue(9));
+
+  // A field whose values cannot be written is rejected before recording starts, so setting
+  // its values still notifies dependants and subscribers
+  Graph unsupported;
+  auto& fills = unsupported.addDomain<int>("trade").createField<std::vector<int>>("fills");
+  EXPECT_THROW(unsupported.startJournal(path), std::runtime_error);
+  EXPECT_THROW(unsupported.saveCheckpoint(path), std::runtime_error);
+  std::vector<std::vector<int>> published;
+  fills.subscribe([&](int, const std::vector<int>& value) { published.push_back(value); });
+  fills.setValue(1, std::vector<int> {1, 2});
+  unsupported.publish();
+  EXPECT_EQ((std::vector<std::vector<int>> {{1, 2}}), published);
+
+  // Journals name the fields they record, so replaying into another graph is detected
+  Graph other;
+  auto& trade = other.addDomain<int>("trade");
+  trade.createField<double>("cumQty");
+  EXPECT_THROW(other.replayJournal(path), std::runtime_error);
+
+  std::remove(path.c_str());
+}
+
+TEST(DomainTest, instrumentFields)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("trade");
+  graph.setInstrumented(true);
+
+  // Domains and fields created after instrumenting are instrumented too
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& qty = trade.createField<int>("qty");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& px = instrument.createField<double>("px");
+  auto& notional = trade.compute<double>("notional", std::tie(qty, px),
+    [](int q, double p) { return q * p; });
+  notional.subscribe([](const int&, const double&) {});
+
+  px.setValue("@VOD", 2.0);
+  for (int i = 0; i < 10; i++)
+  {
+    tradeInstrument.setValue(i, "@VOD");
+    if (i != 9)
+      qty.setValue(i, i);
+  }
+  graph.compute();
+  graph.publish();
+  EXPECT_EQ(9, qty.getStats()->setValueCount);
+
+  // A change to one instrument fans out to its ten trades, one of which lacks a quantity
+  graph.resetStats();
+  px.setValue("@VOD", 3.0);
+  graph.compute();
+  graph.publish();
+
+  ASSERT_NE(nullptr, px.getStats());
+  EXPECT_EQ(1, px.getStats()->setValueCount);
+  EXPECT_EQ(1, px.getStats()->fanOut.getCount());
+  EXPECT_EQ(10, px.getStats()->fanOut.getMax());
+  EXPECT_EQ(0, qty.getStats()->setValueCount);
+
+  const FieldStats& stats = *notional.getStats();
+  EXPECT_EQ(9, stats.setValueCount);
+  EXPECT_EQ(9, stats.recalculateCount);
+  EXPECT_EQ(1, stats.abortedRecalculateCount);
+  EXPECT_EQ(1, stats.computeNanos.getCount());
+  EXPECT_EQ(1, stats.publishNanos.getCount());
+
+  stringstream dot;
+  graph.toDot(dot);
+  EXPECT_NE(string::npos, dot.str().find("recalcs 9 (aborted 1)"));
+  EXPECT_NE(string::npos, dot.str().find("fan-out mean 10 max 10"));
+  EXPECT_NE(string::npos, dot.str().find("fillcolor=\"0.000 1.000 1.000\""));
+
+  // The stream's formatting is left as it was
+  dot.str("");
+  dot << 1.23456789;
+  EXPECT_EQ("1.23457", dot.str());
+
+  graph.setInstrumented(false);
+  EXPECT_EQ(nullptr, notional.getStats());
+  dot.str("");
+  graph.toDot(dot);
+  EXPECT_EQ(string::npos, dot.str().find("fillcolor"));
+
+  // Percentiles are reported to within the precision of the histogram's buckets
+  Histogram histogram;
+  for (uint64_t value = 1; value <= 1000; value++)
+    histogram.record(value);
+  EXPECT_EQ(1, histogram.getMin());
+  EXPECT_EQ(1000, histogram.getMax());
+  EXPECT_DOUBLE_EQ(500.5, histogram.getMean());
+  EXPECT_NEAR(500, histogram.getPercentile(50), 500 * 0.04);
+  EXPECT_NEAR(990, histogram.getPercentile(99), 990 * 0.04);
+  EXPECT_EQ(1000, histogram.getPercentile(100));
+}
+
+TEST(ComputedFieldTest, accumulateWindows)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& lastPx = instrument.createField<double>("lastPx");
+  auto& lastQty = instrument.createField<unsigned>("lastQty");
+  auto& lastTime = instrument.createField<int64_t>("lastTime");
+  string vod = "@VOD";
+  string bt = "@BT";
+
+  auto& sumPx = instrument.accumulate<double>("sumPx3", std::tie(lastPx), RollingSum<double>(3));
+  auto& avgPx = instrument.accumulate<double>("avgPx3", std::tie(lastPx), MovingAverage(3));
+  auto& ewmaPx = instrument.accumulate<double>("ewmaPx", std::tie(lastPx), Ewma(0.5));
+  auto& vwap = instrument.accumulate<double>("vwap", std::tie(lastPx, lastQty), Vwap());
+  auto& avgPx10s = instrument.accumulate<double>("avgPx10s", std::tie(lastTime, lastPx), TimeWindowAverage<int64_t>(10));
+
+  std::vector<double> published;
+  sumPx.subscribe([&](const string&, const double& value) { published.push_back(value); }, Delivery::EveryChange);
+
+  auto tick = [&](int64_t time, double px, unsigned qty)
+  {
+    lastTime.setValue("@VOD", time);
+    lastPx.setValue("@VOD", px);
+    lastQty.setValue("@VOD", qty);
+    graph.compute();
+    graph.publish();
+  };
+
+  tick(0, 1.0, 100);
+  tick(4, 2.0, 300);
+  tick(8, 3.0, 100);
+  tick(12, 4.0, 500);
+
+  EXPECT_DOUBLE_EQ(2.0 + 3.0 + 4.0, sumPx.getValue(vod));
+  EXPECT_DOUBLE_EQ(3.0, avgPx.getValue(vod));
+  EXPECT_DOUBLE_EQ(3.125, ewmaPx.getValue(vod));
+  EXPECT_DOUBLE_EQ((100 * 1.0 + 300 * 2.0 + 100 * 3.0 + 500 * 4.0) / 1000, vwap.getValue(vod));
+  EXPECT_DOUBLE_EQ((2.0 + 3.0 + 4.0) / 3, avgPx10s.getValue(vod));
+  EXPECT_EQ(std::vector<double>({1.0, 3.0, 6.0, 9.0}), published);
+
+  // Each change within one compute is a sample of its own, and keys accumulate apart
+  lastPx.setValue("@VOD", 10.0);
+  lastPx.setValue("@VOD", 5.0);
+  lastPx.setValue("@BT", 7.0);
+  graph.compute();
+
+  EXPECT_DOUBLE_EQ(4.0 + 10.0 + 5.0, sumPx.getValue(vod));
+  EXPECT_DOUBLE_EQ(7.0, sumPx.getValue(bt));
+  EXPECT_DOUBLE_EQ(7.0, ewmaPx.getValue(bt));
+
+  // Windows continue from where they were once restored from a checkpoint
+  string path = "flux_test_accumulate_checkpoint";
+  graph.saveCheckpoint(path);
+
+  Graph restored;
+  auto& restoredInstrument = restored.addDomain<string>("instrument");
+  auto& restoredLastPx = restoredInstrument.createField<double>("lastPx");
+  auto& restoredLastQty = restoredInstrument.createField<unsigned>("lastQty");
+  auto& restoredLastTime = restoredInstrument.createField<int64_t>("lastTime");
+  auto& restoredSumPx = restoredInstrument.accumulate<double>("sumPx3", std::tie(restoredLastPx), RollingSum<double>(3));
+  restoredInstrument.accumulate<double>("avgPx3", std::tie(restoredLastPx), MovingAverage(3));
+  restoredInstrument.accumulate<double>("ewmaPx", std::tie(restoredLastPx), Ewma(0.5));
+  auto& restoredVwap = restoredInstrument.accumulate<double>("vwap", std::tie(restoredLastPx, restoredLastQty), Vwap());
+  restoredInstrument.accumulate<double>("avgPx10s", std::tie(restoredLastTime, restoredLastPx), TimeWindowAverage<int64_t>(10));
+  restored.loadCheckpoint(path);
+  std::remove(path.c_str());
+
+  lastPx.setValue("@VOD", 6.0);
+  graph.compute();
+  restoredLastPx.setValue("@VOD", 6.0);
+  restored.compute();
+  EXPECT_DOUBLE_EQ(10.0 + 5.0 + 6.0, restoredSumPx.getValue(vod));
+  EXPECT_DOUBLE_EQ(vwap.getValue(vod), restoredVwap.getValue(vod));
+
+  // A time window grows to hold its samples, and evicts them only as later samples are added
+  TimeWindowAverage<int64_t> window(10);
+  for (int64_t time = 0; time < 100; time++)
+    window.add(time, double(time));
+  EXPECT_EQ(10, window.size());
+  EXPECT_DOUBLE_EQ(94.5, window.get());
+  window.add(1000, 1.0);
+  EXPECT_EQ(1, window.size());
+  EXPECT_DOUBLE_EQ(1.0, window.get());
+}
+
+TEST(ComputedFieldTest, accumulateAcrossRelation)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("trade");
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& px = instrument.createField<double>("px");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& sumPx = trade.accumulate<double>("sumPx", std::tie(px), RollingSum<double>(10));
+
+  tradeInstrument.setValue(1, "@VOD");
+  px.setValue("@VOD", 2.0);
+  px.setValue("@BT", 3.0);
+  graph.compute();
+  EXPECT_DOUBLE_EQ(2.0, sumPx.getValue(1));
+
+  // Re-pointing the relation changes which price is sampled, but is not itself a sample
+  tradeInstrument.setValue(1, "@BT");
+  graph.compute();
+  tradeInstrument.setValue(1, "@VOD");
+  graph.compute();
+  EXPECT_DOUBLE_EQ(2.0, sumPx.getValue(1));
+
+  tradeInstrument.setValue(1, "@BT");
+  px.setValue("@BT", 4.0);
+  graph.compute();
+  EXPECT_DOUBLE_EQ(2.0 + 4.0, sumPx.getValue(1));
+
+  // A row has no value until an input changes after it relates to one
+  tradeInstrument.setValue(2, "@VOD");
+  graph.compute();
+  EXPECT_EQ(sumPx.end(), sumPx.find(2));
+}
+
+TEST(ComputedFieldTest, aggregateAcrossRelation)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("trade");
+  auto& instrument = graph.addDomain<string>("instrument");
+
+  auto& qty = trade.createField<int>("qty");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& px = instrument.createField<double>("px");
+  auto& notional = trade.compute<double>("notional", std::tie(qty, px),
+    [](int q, double p) { return q * p; });
+
+  auto& totalNotional = instrument.aggregate<double>("totalNotional", notional, tradeInstrument, Sum<double>());
+  auto& tradeCount = instrument.aggregate<size_t>("tradeCount", notional, tradeInstrument, Count());
+  auto& minQty = instrument.aggregate<std::optional<int>>("minQty", qty, tradeInstrument, Min<int>());
+  auto& maxQty = instrument.aggregate<std::optional<int>>("maxQty", qty, tradeInstrument, Max<int>());
+  auto& meanNotional = instrument.compute<double>("meanNotional", std::tie(totalNotional, tradeCount),
+    [](double total, size_t count) { return total / count; });
+
+  string vod = "@VOD";
+  string bt = "@BT";
+
+  px.setValue(vod, 2.0);
+  px.setValue(bt, 3.0);
+  for (int i = 0; i < 10; i++)
+  {
+    qty.setValue(i, i + 1);
+    tradeInstrument.setValue(i, i < 6 ? vod : bt);
+  }
+  graph.compute();
+
+  EXPECT_DOUBLE_EQ(2.0 * (1 + 2 + 3 + 4 + 5 + 6), totalNotional.getValue(vod));
+  EXPECT_DOUBLE_EQ(3.0 * (7 + 8 + 9 + 10), totalNotional.getValue(bt));
+  EXPECT_EQ(6, tradeCount.getValue(vod));
+  EXPECT_EQ(1, minQty.getValue(vod));
+  EXPECT_EQ(6, maxQty.getValue(vod));
+  EXPECT_EQ(7, minQty.getValue(bt));
+  EXPECT_DOUBLE_EQ(2.0 * 21 / 6, meanNotional.getValue(vod));
+
+  // A change to one trade replaces its contribution
+  qty.setValue(0, 20);
+  graph.compute();
+
+  EXPECT_DOUBLE_EQ(2.0 * (20 + 2 + 3 + 4 + 5 + 6), totalNotional.getValue(vod));
+  EXPECT_EQ(2, minQty.getValue(vod));
+  EXPECT_EQ(20, maxQty.getValue(vod));
+
+  // Moving a trade moves its contribution, and a change to an instrument reaches its aggregates
+  // through the trades' computed field
+  tradeInstrument.setValue(9, vod);
+  px.setValue(bt, 4.0);
+  graph.compute();
+
+  EXPECT_DOUBLE_EQ(2.0 * (20 + 2 + 3 + 4 + 5 + 6 + 10), totalNotional.getValue(vod));
+  EXPECT_DOUBLE_EQ(4.0 * (7 + 8 + 9), totalNotional.getValue(bt));
+  EXPECT_EQ(7, tradeCount.getValue(vod));
+  EXPECT_EQ(3, tradeCount.getValue(bt));
+  EXPECT_EQ(9, maxQty.getValue(bt));
+  EXPECT_EQ(20, maxQty.getValue(vod));
+
+  std::vector<string> published;
+  totalNotional.subscribe([&](const string& key, const double&) { published.push_back(key); });
+  graph.publish();
+  qty.setValue(8, 1);
+  graph.compute();
+  graph.publish();
+  EXPECT_EQ(std::vector<string>({bt}), published);
+  EXPECT_EQ(1, minQty.getValue(bt));
+
+  // An aggregate created over existing values has them once computed
+  auto& sumQty = instrument.aggregate<int>("sumQty", qty, tradeInstrument, Sum<int>());
+  EXPECT_TRUE(graph.isComputeRequired());
+  graph.compute();
+  EXPECT_EQ(20 + 2 + 3 + 4 + 5 + 6 + 10, sumQty.getValue(vod));
+  EXPECT_EQ(7 + 8 + 1, sumQty.getValue(bt));
+
+  // Means of negative values are divided in the result's type
+  auto& meanQty = instrument.aggregate<std::optional<double>>("meanQty", qty, tradeInstrument, Mean<int>());
+  auto& meanLongQty = instrument.aggregate<std::optional<long>>("meanLongQty", qty, tradeInstrument, Mean<long>());
+  string sap = "@SAP";
+  qty.setValue(10, -4);
+  qty.setValue(11, -1);
+  tradeInstrument.setValue(10, sap);
+  tradeInstrument.setValue(11, sap);
+  graph.compute();
+  EXPECT_EQ(-2.5, meanQty.getValue(sap));
+  EXPECT_EQ(-2, meanLongQty.getValue(sap));
+
+  // Once no trades relate to an instrument, aggregators without a result give an empty value
+  tradeInstrument.setValue(10, bt);
+  tradeInstrument.setValue(11, bt);
+  graph.compute();
+  EXPECT_EQ(0, sumQty.getValue(sap));
+  EXPECT_EQ(std::nullopt, minQty.getValue(sap));
+  EXPECT_EQ(std::nullopt, maxQty.getValue(sap));
+  EXPECT_EQ(std::nullopt, meanQty.getValue(sap));
+  EXPECT_EQ(-4, minQty.getValue(bt));
+}
+
+TEST(ComputedFieldTest, aggregateAfterRepointingManyTimes)
+{
+  Graph graph;
+  auto& trade = graph.addDomain<int>("trade");
+  auto& instrument = graph.addDomain<string>("instrument");
+
+  auto& notional = trade.createField<double>("notional");
+  auto& tradeInstrument = trade.createRelationTo(instrument);
+  auto& totalNotional = instrument.aggregate<double>("totalNotional", notional, tradeInstrument, Sum<double>());
+  auto& meanNotional = instrument.aggregate<std::optional<double>>("meanNotional", notional, tradeInstrument, Mean<double>());
+
+  std::vector<string> instruments = {"@VOD", "@BT", "@SAP"};
+  const int tradeCount = 100;
+  for (int i = 0; i < tradeCount; i++)
+  {
+    notional.setValue(i, 0.1 * (i + 1) + 1e6 * (i % 2));
+    tradeInstrument.setValue(i, instruments[i % instruments.size()]);
+  }
+  graph.compute();
+
+  // Each move removes a value from one running sum and adds it to another, rounding both
+  for (int move = 0; move < 10000; move++)
+  {
+    tradeInstrument.setValue(move * 7 % tradeCount, instruments[move % instruments.size()]);
+    if (move % 10 == 0)
+      graph.compute();
+  }
+  graph.compute();
+
+  for (auto const& key : instruments)
+  {
+    double total = 0;
+    for (int i = 0; i < tradeCount; i++)
+      if (tradeInstrument.getValue(i) == key)
+        total += notional.getValue(i);
+    EXPECT_NEAR(total, totalNotional.getValue(key), 1e-6);
+  }
+
+  // Once no trades remain, no error remains either
+  for (int i = 0; i < tradeCount; i++)
+    tradeInstrument.setValue(i, instruments[0]);
+  graph.compute();
+  EXPECT_EQ(0.0, totalNotional.getValue(instruments[1]));
+  EXPECT_EQ(std::nullopt, meanNotional.getValue(instruments[1]));
+
+  tradeInstrument.setValue(0, instruments[1]);
+  graph.compute();
+  EXPECT_EQ(notional.getValue(0), totalNotional.getValue(instruments[1]));
+  EXPECT_EQ(notional.getValue(0), meanNotional.getValue(instruments[1]));
+}
+
+TEST(FieldTest, suppressUnchangedValues)
+{
+  Graph graph;
+  auto& instrument = graph.addDomain<string>("instrument");
+  auto& px = instrument.createField<double>("px");
+
+  int roundCount = 0;
+  auto& roundedPx = instrument.compute<double>("roundedPx", std::tie(px),
+    [&](double p) { roundCount++; return std::round(p); });
+
+  int spreadCount = 0;
+  auto& spread = instrument.compute<double>("spread", std::tie(roundedPx),
+    [&](double p) { spreadCount++; return p * 0.01; });
+
+  std::vector<double> published;
+  roundedPx.subscribe([&](const string&, const double& value) { published.push_back(value); }, Delivery::EveryChange);
+
+  px.setEquality(Tolerance<double>(1e-6));
+  roundedPx.setEquality(std::equal_to<double>());
+  graph.setInstrumented(true);
+
+  string vod = "@VOD";
+  px.setValue(vod, 10.2);
+  graph.compute();
+  graph.publish();
+  EXPECT_EQ(1, roundCount);
+  EXPECT_EQ(1, spreadCount);
+
+  // A change within tolerance is neither stored nor propagated
+  px.setValue(vod, 10.2 + 1e-9);
+  graph.compute();
+  EXPECT_EQ(1, roundCount);
+  EXPECT_DOUBLE_EQ(10.2, px.getValue(vod));
+
+  // A change that rounds to the same result stops at the rounded field
+  px.setValue(vod, 10.4);
+  graph.compute();
+  graph.publish();
+  EXPECT_EQ(2, roundCount);
+  EXPECT_EQ(1, spreadCount);
+  EXPECT_EQ(std::vector<double>({10.0}), published);
+  EXPECT_EQ(1, px.getStats()->suppressedCount);
+  EXPECT_EQ(1, roundedPx.getStats()->suppressedCount);
+
+  px.setValue(vod, 10.6);
+  graph.compute();
+  graph.publish();
+  EXPECT_EQ(2, spreadCount);
+  EXPECT_DOUBLE_EQ(0.11, spread.getValue(vod));
+  EXPECT_EQ(std::vector<double>({10.0, 11.0}), published);
+
+  // Without a policy, every value propagates
+  roundedPx.setEquality(nullptr);
+  px.setValue(vod, 10.7);
+  graph.compute();
+  EXPECT_EQ(3, spreadCount);
+}